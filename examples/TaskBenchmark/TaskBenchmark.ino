@@ -0,0 +1,230 @@
+#include <Taskfun.h>
+
+// Benchmarks for the task switcher. Results are printed over Serial as CSV
+// lines, times are in CPU cycles:
+//
+//   bench,<name>,<param>,<min>,<avg>,<max>
+//
+// `empty` is the cost of reading the cycle counter, subtract it from the other
+// results. On AVR the sketch stops the CPU when done so that simavr exits, use
+// extras/benchmark/run_simavr.sh to run it headless.
+
+#if defined(ARDUINO_ARCH_AVR)
+#include <avr/sleep.h>
+
+void startCounter() {
+  // Timer1 without prescaler counts CPU cycles
+  TCCR1A = 0;
+  TCCR1B = _BV(CS10);
+}
+
+inline unsigned long counter() {
+  return TCNT1;
+}
+
+inline unsigned long elapsed(unsigned long start, unsigned long end) {
+  return (uint16_t)(end - start);
+}
+
+void stop() {
+  Serial.flush();
+  noInterrupts();
+  sleep_enable();
+  sleep_cpu();
+}
+
+#elif defined(ARDUINO_ARCH_SAMD)
+
+void startCounter() {
+  // SysTick counts CPU cycles down and is reloaded every 1ms by the core
+}
+
+inline unsigned long counter() {
+  return SysTick->VAL;
+}
+
+inline unsigned long elapsed(unsigned long start, unsigned long end) {
+  return start >= end ? start - end : start + SysTick->LOAD + 1 - end;
+}
+
+void stop() {
+  Serial.flush();
+  while (1)
+    ;
+}
+
+#endif
+
+const int _iterations = 200;
+const int _maxPaused = 8;
+
+struct Stats {
+  unsigned long lowest;
+  unsigned long highest;
+  unsigned long total;
+  unsigned count;
+
+  Stats()
+    : lowest(~0UL), highest(0), total(0), count(0) {}
+
+  void add(unsigned long cycles) {
+    if (cycles < lowest) lowest = cycles;
+    if (cycles > highest) highest = cycles;
+    total += cycles;
+    ++count;
+  }
+};
+
+void report(const char* name, int param, Stats& stats) {
+  Serial.print("bench,");
+  Serial.print(name);
+  Serial.print(",");
+  Serial.print(param);
+  Serial.print(",");
+  Serial.print(stats.lowest);
+  Serial.print(",");
+  Serial.print(stats.total / stats.count);
+  Serial.print(",");
+  Serial.println(stats.highest);
+}
+
+// keeps switching back to the benchmark
+void yielder(int) {
+  while (1) {
+    yield();
+  }
+}
+
+// created paused, never runs
+void sleeper(int) {
+  while (1)
+    ;
+}
+
+int runPaused() {
+  noInterrupts();
+  auto id = runTask(sleeper, 0, 16);
+  pauseTask(id);
+  interrupts();
+  return id;
+}
+
+void benchEmpty() {
+  Stats stats;
+  for (auto i = 0; i < _iterations; ++i) {
+    auto start = counter();
+    auto end = counter();
+    stats.add(elapsed(start, end));
+  }
+  report("empty", 0, stats);
+}
+
+// yield() from the benchmark, with another task runnable this is a round trip
+// of two context switches
+void benchYield(const char* name, int param) {
+  Stats stats;
+  for (auto i = 0; i < _iterations; ++i) {
+    auto start = counter();
+    yield();
+    auto end = counter();
+    stats.add(elapsed(start, end));
+  }
+  report(name, param, stats);
+}
+
+// get_next_task() skips paused tasks, measure the round trip against their count
+void benchNextTask() {
+  int paused[_maxPaused];
+  auto count = 0;
+  auto id = runTask(yielder, 0, 64);
+  for (auto n = 0; n <= _maxPaused; n = n ? n * 2 : 1) {
+    while (count < n) {
+      paused[count++] = runPaused();
+    }
+    benchYield("switch_roundtrip", n);
+  }
+  stopTask(id);
+  while (count) {
+    stopTask(paused[--count]);
+  }
+}
+
+void benchSpawn() {
+  Stats runStats;
+  Stats stopStats;
+  for (auto i = 0; i < _iterations; ++i) {
+    noInterrupts();
+    auto start = counter();
+    auto id = runTask(sleeper, 0, 16);
+    auto end = counter();
+    pauseTask(id);
+    interrupts();
+    runStats.add(elapsed(start, end));
+
+    start = counter();
+    stopTask(id);
+    end = counter();
+    stopStats.add(elapsed(start, end));
+  }
+  report("run_task", 0, runStats);
+  report("stop_task", 0, stopStats);
+}
+
+volatile int _raw;
+SyncVar<int> _sync;
+
+void benchSyncVar() {
+  Stats raw;
+  Stats sync;
+  for (auto i = 0; i < _iterations; ++i) {
+    auto start = counter();
+    _raw += 1;
+    auto end = counter();
+    raw.add(elapsed(start, end));
+
+    start = counter();
+    _sync += 1;
+    end = counter();
+    sync.add(elapsed(start, end));
+  }
+  report("raw_add", 0, raw);
+  report("syncvar_add", 0, sync);
+
+  raw = Stats();
+  sync = Stats();
+  for (auto i = 0; i < _iterations; ++i) {
+    auto start = counter();
+    int value = _raw;
+    auto end = counter();
+    raw.add(elapsed(start, end));
+
+    start = counter();
+    value = _sync;
+    end = counter();
+    sync.add(elapsed(start, end));
+    (void)value;
+  }
+  report("raw_read", 0, raw);
+  report("syncvar_read", 0, sync);
+}
+
+void setup() {
+  Serial.begin(115200);
+  setupTasks(_maxPaused + 2);
+  startCounter();
+
+  Serial.print("meta,cpu_hz,");
+  Serial.println(F_CPU);
+
+  benchEmpty();
+  benchYield("yield_alone", 0);
+  benchNextTask();
+  benchSpawn();
+  benchSyncVar();
+
+  Serial.println("done");
+  stop();
+}
+
+void loop() {
+}
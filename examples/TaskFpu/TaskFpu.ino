@@ -0,0 +1,81 @@
+#include <Taskfun.h>
+
+// Checks that tasks keep their floating point registers across task switches.
+// Two tasks repeat the same float computation and compare each result with
+// the first one while a third task only uses integers, all three are
+// preempted on every tick. On a Cortex-M4F board like the Metro M4 this
+// exercises the FPU context save in the task switch, on other boards the
+// floats are computed in software. Prints PASS or FAIL over Serial every 10
+// seconds.
+
+SyncVar<unsigned long> _rounds;
+SyncVar<unsigned long> _errors;
+volatile unsigned long _count;
+
+// 20 dependent values don't fit in the 16 caller-saved registers s0-s15, so
+// s16-s31 are live while the task is preempted
+__attribute__((noinline)) float compute(int seed) {
+  float v0 = seed, v1 = v0 * 1.1f, v2 = v0 * 1.2f, v3 = v0 * 1.3f, v4 = v0 * 1.4f;
+  float v5 = v0 * 1.5f, v6 = v0 * 1.6f, v7 = v0 * 1.7f, v8 = v0 * 1.8f, v9 = v0 * 1.9f;
+  float v10 = v0 * 2.1f, v11 = v0 * 2.2f, v12 = v0 * 2.3f, v13 = v0 * 2.4f, v14 = v0 * 2.5f;
+  float v15 = v0 * 2.6f, v16 = v0 * 2.7f, v17 = v0 * 2.8f, v18 = v0 * 2.9f, v19 = v0 * 3.1f;
+  for (auto i = 0; i < 500; ++i) {
+    v0 = v0 * 0.99f + v19;
+    v1 = v1 * 0.98f + v0;
+    v2 = v2 * 0.97f + v1;
+    v3 = v3 * 0.96f + v2;
+    v4 = v4 * 0.95f + v3;
+    v5 = v5 * 0.94f + v4;
+    v6 = v6 * 0.93f + v5;
+    v7 = v7 * 0.92f + v6;
+    v8 = v8 * 0.91f + v7;
+    v9 = v9 * 0.90f + v8;
+    v10 = v10 * 0.89f - v9;
+    v11 = v11 * 0.88f - v10;
+    v12 = v12 * 0.87f - v11;
+    v13 = v13 * 0.86f - v12;
+    v14 = v14 * 0.85f - v13;
+    v15 = v15 * 0.84f - v14;
+    v16 = v16 * 0.83f - v15;
+    v17 = v17 * 0.82f - v16;
+    v18 = v18 * 0.81f - v17;
+    v19 = v19 * 0.80f - v18;
+  }
+  return v0 + v1 + v2 + v3 + v4 + v5 + v6 + v7 + v8 + v9 + v10 + v11 + v12 + v13 + v14 + v15 + v16 + v17 + v18 + v19;
+}
+
+// the same computation gives the same bits unless a task switch lost a register
+void fpuTask(int seed) {
+  auto expected = compute(seed);
+  while (1) {
+    if (compute(seed) != expected) {
+      ++_errors;
+    }
+    ++_rounds;
+  }
+}
+
+void intTask(int) {
+  while (1) {
+    ++_count;
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+  setupTasks();
+  runTask(fpuTask, 1, 512);
+  runTask(fpuTask, 2, 512);
+  runTask(intTask, 0, 128);
+}
+
+void loop() {
+  delay(10000);
+  unsigned long rounds = _rounds;
+  unsigned long errors = _errors;
+  Serial.print(F("rounds "));
+  Serial.print(rounds);
+  Serial.print(F(" errors "));
+  Serial.print(errors);
+  Serial.println(rounds && !errors ? F(" PASS") : F(" FAIL"));
+}
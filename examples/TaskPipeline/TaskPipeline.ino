@@ -0,0 +1,65 @@
+#include <Taskfun.h>
+
+// Sampling an analog input, filtering the samples and printing them from four
+// tasks. Sample blocks are passed between the tasks by pointer, they're never
+// copied. Each buffer is owned by one task at a time: the sampler acquires it
+// from the pool, the printer releases it back. Two filter tasks receive from
+// the same channel, whichever is free takes the next block, so blocks may be
+// printed out of order.
+
+const int _samples = 32;
+const int _inputPin = A0;
+
+BufferPool<_samples * sizeof(int), 4> _pool;
+Channel<uint8_t*, 4> _raw;       // sampler -> filters
+Channel<uint8_t*, 4> _filtered;  // filters -> printer
+
+// fill a buffer with samples and pass it on
+void sample(int) {
+  while (1) {
+    auto buffer = _pool.acquire();  // waits if all buffers are in use
+    auto samples = (int*)buffer;
+    for (auto i = 0; i < _samples; ++i) {
+      samples[i] = analogRead(_inputPin);
+      sleepTask(1);
+    }
+    _raw.send(buffer);
+  }
+}
+
+// moving average over 4 samples, in place
+void filter(int) {
+  while (1) {
+    uint8_t* buffer;
+    _raw.receive(buffer);  // waits for the next block, never fails without a timeout
+    auto samples = (int*)buffer;
+    int history[4] = { samples[0], samples[0], samples[0], samples[0] };
+    long sum = samples[0] * 4L;
+    for (auto i = 0; i < _samples; ++i) {
+      sum += samples[i] - history[i % 4];
+      history[i % 4] = samples[i];
+      samples[i] = sum / 4;
+    }
+    _filtered.send(buffer);
+  }
+}
+
+void setup() {
+  Serial.begin(115200);
+  setupTasks();
+  runTask(sample, 0, 64);
+  runTask(filter, 0, 64);
+  runTask(filter, 1, 64);
+}
+
+// print the block and return the buffer to the pool
+void loop() {
+  uint8_t* buffer;
+  if (_filtered.receive(buffer, 1000)) {
+    auto samples = (int*)buffer;
+    for (auto i = 0; i < _samples; ++i) {
+      Serial.println(samples[i]);
+    }
+    _pool.release(buffer);
+  }
+}
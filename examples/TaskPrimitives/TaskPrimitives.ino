@@ -4,6 +4,7 @@
 class Semaphore {
 protected:
   unsigned _count; // resource count
+  ConditionVariable _available; // signaled when a resource is released
 
 public:
   Semaphore(unsigned count)
@@ -11,22 +12,19 @@ public:
 
   // decrement resource count or block if resource not available
   void acquire() {
-    while (1) {
-      noInterrupts();
-      if (_count > 0) {
-        --_count;
-        interrupts();
-        break;
-      }
-      interrupts();
-      yield();
+    noInterrupts();
+    while (_count == 0) {
+      _available.wait();
     }
+    --_count;
+    interrupts();
   }
 
   // increment count of available resources
   void release() {
     noInterrupts();
     ++_count;
+    _available.notifyOne();
     interrupts();
   }
 };
@@ -53,6 +51,7 @@ const int _buzzerPin = 3; // buzzer pin to listen to Morse code
 SyncVar<bool> _ledInUse[_numLeds] = { 0, 0, 0 }; // which led is in use
 Semaphore _semaphore(_numLeds); // semaphore for 3 LEDs
 Mutex _mutex; // mutex for single Serial object to use for printing
+TaskStream _input(Serial); // reading from _input suspends loop() until data arrives
 
 // Morse code table form A to Z
 const char* _letters[] = { ".-", "-...", "-.-.", "-..", ".", "..-.", "--.", "....", "..", ".---", "-.-", ".-..", "--", "-.", "---", ".--.", "--.-", ".-.", "...", "-", "..-", "...-", ".--", "-..-", "-.--", "--.." };
@@ -136,9 +135,12 @@ void setup() {
   runTask(produceTone, 0, 64);
 }
 
-void loop() {  
-  if (Serial.available()) {    
-    auto message = Serial.readString();
+void loop() {
+  char buffer[64];
+  auto length = _input.readBytesUntil('\n', buffer, sizeof(buffer) - 1);
+  if (length) {
+    buffer[length] = 0;
+    String message(buffer);
     runTask(processMessage, message, 96);
   }
 }
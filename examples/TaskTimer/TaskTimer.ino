@@ -0,0 +1,40 @@
+#include <Taskfun.h>
+
+// LED pin and its state, passed to the timer callback
+struct Led {
+  int pin;
+  bool on;
+};
+
+Led _led1 = { 10, false };
+Led _led2 = { 11, false };
+
+// timer callback toggling an LED
+void toggle(void* arg) {
+  auto led = (Led*)arg;
+  led->on = !led->on;
+  digitalWrite(led->pin, led->on ? HIGH : LOW);
+}
+
+// one-shot timer callback
+void hello(void*) {
+  Serial.println("Hello after 5 seconds");
+}
+
+void setup() {
+  Serial.begin(115200);
+  pinMode(_led1.pin, OUTPUT);
+  pinMode(_led2.pin, OUTPUT);
+  setupTasks();
+
+  // all timers run from a single timer task
+  setupTimers();
+  createTimer(500, toggle, &_led1);
+  createTimer(1000, toggle, &_led2);
+  createTimer(5000, hello, 0, true /* one-shot */);
+}
+
+void loop() {
+  // nothing to do here, sleep instead of spinning
+  sleepTask(1000);
+}
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Builds the TaskBenchmark example for Arduino Uno and runs it in simavr,
+# printing the benchmark results as CSV. The sketch stops the CPU when done
+# which makes simavr exit.
+#
+# Requires arduino-cli with the arduino:avr core installed, and simavr.
+#
+#   extras/benchmark/run_simavr.sh [results.csv]
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/../.." && pwd)
+BUILD=$(mktemp -d)
+trap 'rm -rf "$BUILD"' EXIT
+
+arduino-cli compile --fqbn arduino:avr:uno --library "$ROOT" --output-dir "$BUILD" "$ROOT/examples/TaskBenchmark"
+
+# simavr prints the UART output with color codes, keep the CSV lines only
+timeout 600 simavr -m atmega328p -f 16000000 "$BUILD/TaskBenchmark.ino.elf" 2>&1 \
+  | sed 's/\x1b\[[0-9;]*m//g' | tr -d '\r' \
+  | grep -o '\(meta\|bench\),.*' > "${1:-/dev/stdout}"
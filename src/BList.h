@@ -9,16 +9,30 @@ protected:
   T* _array;
   unsigned _count;
   unsigned _capacity;
+  bool _owned;  // false while the array is static storage given to Attach()
 
 public:
   BList(uint16_t capacity)
-    : _array(new T[capacity]), _count(0), _capacity(capacity)  {}
+    : _array(new T[capacity]), _count(0), _capacity(capacity), _owned(true)  {}
 
   BList()
-    : _array(0), _count(0), _capacity(0) {}
+    : _array(0), _count(0), _capacity(0), _owned(true) {}
 
   ~BList() {
-    delete[] _array;
+    if (_owned) {
+      delete[] _array;
+    }
+  }
+
+  // uses an array the list doesn't own, it is left alone when the list grows
+  void Attach(T* array, unsigned capacity) {
+    if (_owned) {
+      delete[] _array;
+    }
+    _array = array;
+    _count = 0;
+    _capacity = capacity;
+    _owned = false;
   }
 
   T& operator[](unsigned index) {
@@ -48,14 +62,30 @@ public:
     return _capacity;
   }
 
+  // takes over a bigger preallocated array, returns the old array for the
+  // caller to delete, so the allocation can happen outside a critical section
+  T* Reserve(T* array, unsigned capacity) {
+    for (unsigned i = 0; i < _count; ++i) {
+      array[i] = _array[i];
+    }
+    T* old = _owned ? _array : 0;
+    _array = array;
+    _capacity = capacity;
+    _owned = true;
+    return old;
+  }
+
   void Resize(unsigned capacity) {
     T* array = new T[capacity];
     for (unsigned i = 0; i < min(capacity, _capacity); ++i) {
       array[i] = _array[i];
     }
-    delete[] _array;
+    if (_owned) {
+      delete[] _array;
+    }
     _array = array;
     _capacity = capacity;
+    _owned = true;
   }
 
   void Compact(T filter) {
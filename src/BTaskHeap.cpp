@@ -0,0 +1,249 @@
+#include <Arduino.h>
+#include <stdlib.h>
+#include <string.h>
+#include "BTaskSwitcher.h"
+#include "BTaskHeap.h"
+
+#ifdef TASKFUN_WRAP_MALLOC
+// the linker sends malloc() and free() calls to the __wrap_ functions below
+extern "C" {
+  void* __real_malloc(size_t size);
+  void __real_free(void* ptr);
+  void* __real_realloc(void* ptr, size_t size);
+}
+#define heap_malloc __real_malloc
+#define heap_realloc __real_realloc
+#define heap_release __real_free
+#else
+#define heap_malloc malloc
+#define heap_realloc realloc
+#define heap_release free
+#endif
+
+namespace Buratino {
+
+// the global heap isn't reentrant, no task switch while it's in use,
+// interrupt handlers must not allocate
+void* BTaskSwitcher::heap_alloc(size_t size) {
+  SchedulerLock lock;
+  auto ptr = heap_malloc(size);
+  return ptr;
+}
+
+void BTaskSwitcher::heap_free(void* ptr) {
+  SchedulerLock lock;
+  heap_release(ptr);
+}
+
+unsigned BTaskSwitcher::arena_block_size(unsigned size) {
+  // room to align the arena data
+  return size ? sizeof(BArena) + size + BTaskHeap::Align - 1 : 0;
+}
+
+BTaskSwitcher::BArena* BTaskSwitcher::init_arena(uint8_t* block, unsigned size) {
+  auto arena = (BArena*)block;
+  auto data = (uint8_t*)(((uintptr_t)(block + sizeof(BArena)) + BTaskHeap::Align - 1) & ~(uintptr_t)(BTaskHeap::Align - 1));
+  arena->data = data;
+  arena->size = block + size - data;
+  arena->used = 0;
+  arena->bypass = 0;
+
+  SchedulerLock lock;
+  arena->next = _arenas;
+  _arenas = arena;
+  return arena;
+}
+
+// called before the arena goes back to the global heap
+void BTaskSwitcher::release_arena(BArena* arena) {
+  SchedulerLock lock;
+  auto link = &_arenas;
+  while (*link && *link != arena) {
+    link = &(*link)->next;
+  }
+  if (*link) {
+    *link = arena->next;
+  }
+}
+
+BTaskSwitcher::BGlobalHeap::BGlobalHeap() {
+  arena = BTaskHeap::current_arena();
+  if (arena) {
+    ++arena->bypass;
+  }
+}
+
+BTaskSwitcher::BGlobalHeap::~BGlobalHeap() {
+  if (arena) {
+    --arena->bypass;
+  }
+}
+
+// only the task itself uses its arena, so arena allocations need no lock
+BTaskHeap::BArena* BTaskHeap::current_arena() {
+  auto info = BTaskSwitcher::current_info();
+  return info ? info->arena : 0;
+}
+
+// memory of any live arena, including the arena of a task being destroyed,
+// only tasks with an arena are looked at
+bool BTaskHeap::arena_block(void* ptr) {
+  SchedulerLock lock;
+  for (auto arena = BTaskSwitcher::_arenas; arena; arena = arena->next) {
+    if (contains(arena, ptr)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void* BTaskHeap::arena_alloc(BArena* arena, size_t size) {
+  auto total = Header + align(size);
+  if (total < size || arena->size - arena->used < total) {
+    return 0;
+  }
+
+  auto ptr = arena->data + arena->used + Header;
+  arena->used += total;
+  block_size(ptr) = align(size);
+  return ptr;
+}
+
+// a bump arena only gets the last allocation back, the rest is freed in bulk
+// when the task exits
+void BTaskHeap::arena_free(BArena* arena, void* ptr) {
+  auto end = (uint8_t*)ptr + block_size(ptr);
+  if (end == arena->data + arena->used) {
+    arena->used -= Header + block_size(ptr);
+  }
+}
+
+void* BTaskHeap::allocate(size_t size) {
+  auto arena = current_arena();
+  if (arena && !arena->bypass) {
+    auto ptr = arena_alloc(arena, size);
+    if (ptr) {
+      return ptr;
+    }
+  }
+  return BTaskSwitcher::heap_alloc(size);
+}
+
+void BTaskHeap::release(void* ptr) {
+  if (!ptr) {
+    return;
+  }
+
+  auto arena = current_arena();
+  if (contains(arena, ptr)) {
+    arena_free(arena, ptr);
+  } else if (!arena_block(ptr)) {
+    BTaskSwitcher::heap_free(ptr);
+  }
+  // memory from the arena of another task, or of a task being destroyed, is
+  // freed with that task
+}
+
+void* BTaskHeap::reallocate(void* ptr, size_t size) {
+  if (!ptr) {
+    return allocate(size);
+  }
+
+  auto arena = current_arena();
+  if (contains(arena, ptr)) {
+    auto old_size = block_size(ptr);
+    if (size <= old_size) {
+      return ptr;
+    }
+
+    // the last allocation grows in place
+    auto end = (uint8_t*)ptr + old_size;
+    auto grow = align(size) - old_size;
+    if (end == arena->data + arena->used && arena->size - arena->used >= grow) {
+      arena->used += grow;
+      block_size(ptr) = align(size);
+      return ptr;
+    }
+
+    auto copy = allocate(size);
+    if (copy) {
+      memcpy(copy, ptr, old_size);
+      arena_free(arena, ptr);
+    }
+    return copy;
+  }
+
+  if (arena_block(ptr)) {
+    return 0;
+  }
+
+  SchedulerLock lock;
+  auto copy = heap_realloc(ptr, size);
+  return copy;
+}
+
+}
+
+using namespace Buratino;
+
+void* taskMalloc(size_t size) {
+  return BTaskHeap::allocate(size);
+}
+
+void taskFree(void* ptr) {
+  BTaskHeap::release(ptr);
+}
+
+void* taskRealloc(void* ptr, size_t size) {
+  return BTaskHeap::reallocate(ptr, size);
+}
+
+unsigned getArenaFree() {
+  auto arena = BTaskHeap::current_arena();
+  return arena ? arena->size - arena->used : 0;
+}
+
+#ifdef TASKFUN_SAFE_HEAP
+void* operator new(size_t size) {
+  return taskMalloc(size);
+}
+
+void* operator new[](size_t size) {
+  return taskMalloc(size);
+}
+
+void operator delete(void* ptr) {
+  taskFree(ptr);
+}
+
+void operator delete[](void* ptr) {
+  taskFree(ptr);
+}
+#endif
+
+#ifdef TASKFUN_WRAP_MALLOC
+extern "C" {
+  void* __wrap_malloc(size_t size) {
+    return taskMalloc(size);
+  }
+
+  void __wrap_free(void* ptr) {
+    taskFree(ptr);
+  }
+
+  void* __wrap_realloc(void* ptr, size_t size) {
+    return taskRealloc(ptr, size);
+  }
+
+  void* __wrap_calloc(size_t count, size_t size) {
+    if (size && count > (size_t)-1 / size) {
+      return 0;
+    }
+    auto ptr = taskMalloc(count * size);
+    if (ptr) {
+      memset(ptr, 0, count * size);
+    }
+    return ptr;
+  }
+}
+#endif
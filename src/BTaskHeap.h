@@ -0,0 +1,61 @@
+#ifndef __BTASKHEAP_H__
+#define __BTASKHEAP_H__
+
+#include "BTaskSwitcher.h"
+
+// define TASKFUN_SAFE_HEAP to route new and delete through taskMalloc() and
+// taskFree(), define TASKFUN_WRAP_MALLOC and link with
+// -Wl,--wrap=malloc,--wrap=free,--wrap=realloc,--wrap=calloc to route malloc()
+// and free() too
+
+void* taskMalloc(size_t size);
+void taskFree(void* ptr);
+void* taskRealloc(void* ptr, size_t size);
+unsigned getArenaFree();
+
+namespace Buratino {
+
+/*
+  BTaskHeap - task-safe allocation from the current task's arena or from the
+  global heap
+*/
+class BTaskHeap {
+protected:
+  typedef BTaskSwitcher::BArena BArena;
+  typedef BTaskSwitcher::BDisableInterrupts BDisableInterrupts;
+
+  // arena allocations are aligned like malloc() and prefixed with their size
+  static const unsigned Align = __BIGGEST_ALIGNMENT__;
+  static const unsigned Header = sizeof(unsigned) > Align ? sizeof(unsigned) : Align;
+
+protected:
+  static unsigned align(unsigned size) {
+    return (size + Align - 1) & ~(Align - 1);
+  }
+
+  static unsigned& block_size(void* ptr) {
+    return *(unsigned*)((uint8_t*)ptr - Header);
+  }
+
+  static bool contains(BArena* arena, void* ptr) {
+    return arena && ptr >= arena->data && ptr < arena->data + arena->size;
+  }
+
+  static BArena* current_arena();
+  static bool arena_block(void* ptr);
+  static void* arena_alloc(BArena* arena, size_t size);
+  static void arena_free(BArena* arena, void* ptr);
+  static void* allocate(size_t size);
+  static void release(void* ptr);
+  static void* reallocate(void* ptr, size_t size);
+
+  friend class BTaskSwitcher;
+  friend void* ::taskMalloc(size_t);
+  friend void ::taskFree(void*);
+  friend void* ::taskRealloc(void*, size_t);
+  friend unsigned ::getArenaFree();
+};
+
+}
+
+#endif
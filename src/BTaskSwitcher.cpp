@@ -7,14 +7,25 @@ namespace Buratino {
 
 volatile bool BTaskSwitcher::_initialized = false;
 BList<BTaskSwitcher::BTaskInfoBase*> BTaskSwitcher::_tasks;
-volatile int BTaskSwitcher::_current_task = 0;
-volatile int BTaskSwitcher::_next_task = 0;
-volatile int BTaskSwitcher::_yielded_task = -1;
-int BTaskSwitcher::_slice = 1;
-volatile int BTaskSwitcher::_current_slice = 0;
+BList<int> BTaskSwitcher::_free;
+BList<BTaskSwitcher::BSlot> BTaskSwitcher::_reap;
+volatile BTaskSwitcher::BIsrState BTaskSwitcher::_isr = { 0, 0, 0, -1, -1, 0 };
+BTaskSwitcher::BSlot BTaskSwitcher::_idle_task = -1;
+unsigned BTaskSwitcher::_idle_ticks = 0;
+unsigned BTaskSwitcher::_load_ticks = 0;
+volatile uint8_t BTaskSwitcher::_cpu_load = 0;
+volatile unsigned long BTaskSwitcher::_ticks = 0;
+volatile unsigned long BTaskSwitcher::_next_wake = 0;
+volatile bool BTaskSwitcher::_sleeping = false;
+volatile bool BTaskSwitcher::_polling = false;
+volatile bool BTaskSwitcher::_switch_pending = false;
+BTaskSwitcher::BArena* BTaskSwitcher::_arenas = 0;
+BTaskSwitcher::BSlice BTaskSwitcher::_slice = 1;
 BTaskSwitcher::BSwitchState BTaskSwitcher::_pri[3] = { { 0, 0 }, { 0, 0 }, { 0, 0 } };
+BList<BTaskSwitcher::BTaskInfoBase*> BTaskSwitcher::_periodic;
+uint8_t BTaskSwitcher::_policy = SchedulingPolicy::RateMonotonic;
 
-
+#ifndef TASKFUN_PROFILE_CLI
 BTaskSwitcher::BDisableInterrupts::BDisableInterrupts() {
   enabled = BTaskSwitcher::disable();
 }
@@ -22,6 +33,86 @@ BTaskSwitcher::BDisableInterrupts::BDisableInterrupts() {
 BTaskSwitcher::BDisableInterrupts::~BDisableInterrupts() {
   BTaskSwitcher::restore(enabled);
 }
+#else
+BTaskSwitcher::BCliSite BTaskSwitcher::_cli_sites[TASKFUN_PROFILE_SITES];
+volatile uint8_t BTaskSwitcher::_switches = 0;
+
+BTaskSwitcher::BDisableInterrupts::BDisableInterrupts(const char* tag, int line)
+  : tag(tag), line(line) {
+  enabled = BTaskSwitcher::disable();
+  switches = _switches;
+  start = cycle_count();
+}
+
+BTaskSwitcher::BDisableInterrupts::~BDisableInterrupts() {
+  // only the outermost section disables interrupts, sections that switched
+  // tasks let other tasks run with interrupts enabled
+  if (enabled && switches == _switches) {
+    BTaskSwitcher::record_cli(tag, line, cycles_since(start));
+  }
+  BTaskSwitcher::restore(enabled);
+}
+
+void BTaskSwitcher::record_cli(const char* tag, int line, unsigned long elapsed) {
+  // the last site collects the sections that didn't fit in the table
+  unsigned i = 0;
+  while (i < TASKFUN_PROFILE_SITES - 1 && _cli_sites[i].tag && (_cli_sites[i].tag != tag || _cli_sites[i].line != line)) {
+    ++i;
+  }
+
+  auto& site = _cli_sites[i];
+  if (!site.tag) {
+    site.tag = tag;
+    site.line = line;
+  }
+  if (elapsed > site.max) {
+    site.max = elapsed;
+  }
+  site.total += elapsed;
+  ++site.count;
+}
+
+void BTaskSwitcher::print_cli_profile(Print& out, uint8_t count) {
+  // print the sites with the longest sections first
+  uint32_t printed = 0;
+  for (uint8_t n = 0; n < count; ++n) {
+    BCliSite site = {};
+    int worst = -1;
+    {
+      BDisableInterrupts cli;
+      for (unsigned i = 0; i < TASKFUN_PROFILE_SITES && i < 32; ++i) {
+        if (_cli_sites[i].tag && !(printed & (1UL << i)) && (worst < 0 || _cli_sites[i].max > site.max)) {
+          worst = i;
+          site = _cli_sites[i];
+        }
+      }
+    }
+    if (worst < 0) {
+      break;
+    }
+    printed |= 1UL << worst;
+
+    auto name = strrchr(site.tag, '/');
+    out.print(name ? name + 1 : site.tag);
+    out.print(":");
+    out.print(site.line);
+    if (worst == TASKFUN_PROFILE_SITES - 1) {
+      out.print("+");  // includes the sites that didn't fit
+    }
+    out.print(" max ");
+    out.print(site.max);
+    out.print(" cycles avg ");
+    out.print(site.total / site.count);
+    out.print(" cycles count ");
+    out.println(site.count);
+  }
+}
+
+void BTaskSwitcher::reset_cli_profile() {
+  BDisableInterrupts cli;
+  memset(_cli_sites, 0, sizeof(_cli_sites));
+}
+#endif
 
 void BTaskSwitcher::restore(bool enable) {
   if (enable) interrupts();
@@ -29,41 +120,116 @@ void BTaskSwitcher::restore(bool enable) {
 }
 
 int BTaskSwitcher::current_task_id() {
-  BDisableInterrupts cli;
-  auto id = _current_task;
-  return id;
+  auto taskInfo = current_info();
+  return taskInfo ? taskInfo->id : 0;
+}
+
+// O(1) lookup of the task slot, ids of exited tasks are rejected even if
+// their slot has been reused
+int BTaskSwitcher::slot_of(int id) {
+  if (id < 0) {
+    return -1;
+  }
+
+  int slot = id & SlotMask;
+  if (slot != _idle_task && slot < (int)_tasks.Length() && _tasks[slot] && _tasks[slot]->id == id && !_tasks[slot]->killed()) {
+    return slot;
+  }
+  return -1;
+}
+
+// call with interrupts disabled
+void BTaskSwitcher::release_slot(int slot) {
+  auto taskInfo = _tasks[slot];
+  if (taskInfo->periodic) {
+    remove_periodic(taskInfo);
+  }
+
+  // the next task in this slot gets the next generation id
+  auto generation = ((taskInfo->id >> SlotBits) + 1) & GenerationMask;
+  _free.Add((generation << SlotBits) | slot);
+  _tasks[slot] = 0;
 }
 
-void BTaskSwitcher::free_task(int id) {
-  _tasks[id]->~BTaskInfoBase();
-  delete[](uint8_t*) _tasks[id];
-  _tasks[id] = 0;
+// runs the argument destructors and frees the heap with interrupts enabled
+void BTaskSwitcher::destroy_task(BTaskInfoBase* taskInfo) {
+  if (taskInfo->budget) {
+    heap_free(taskInfo->budget);
+  }
+  taskInfo->destroy(taskInfo);
+}
+
+// free the tasks that exited, called from task context rather than from the
+// switch interrupt to keep swap_stack() constant time
+void BTaskSwitcher::reap_tasks() {
+  while (_reap.Length()) {
+    BTaskInfoBase* taskInfo = 0;
+    {
+      BDisableInterrupts cli;
+      auto count = _reap.Length();
+      if (count) {
+        auto slot = _reap[count - 1];
+        _reap.Remove(count - 1);
+        taskInfo = _tasks[slot];
+        release_slot(slot);
+      }
+    }
+
+    if (taskInfo) {
+      destroy_task(taskInfo);
+    }
+  }
 }
 
 void BTaskSwitcher::kill_task(int id) {
   auto cli = disable();
-  if (id > 0 && id < (int)_tasks.Length() && _tasks[id] && _tasks[id]->id > 0) {
-    --_pri[_tasks[id]->priority()].count;
+  auto slot = slot_of(id);
+  if (slot > 0) {
+    if (!_tasks[slot]->paused()) {
+      --_pri[_tasks[slot]->priority()].count;
+    }
 
-    if (id == _current_task) {
-      _tasks[id]->id = -1;
+    // a running task is reaped after it is switched out
+    if (slot == _isr.current) {
+      _tasks[slot]->kill();
       yield_task();
       restore(cli);
       while (1)
         ;
     }
 
-    free_task(id);
+    auto taskInfo = _tasks[slot];
+    release_slot(slot);
+    restore(cli);
+    destroy_task(taskInfo);
+    return;
   }
   restore(cli);
 }
 
 int BTaskSwitcher::get_next_task() { 
+  auto wake_task = _isr.wake;
+  _isr.wake = -1;
+
+  // released periodic tasks run before the lottery, in rate-monotonic or
+  // earliest deadline first order
+  for (unsigned i = 0; i < _periodic.Length(); ++i) {
+    if (!_periodic[i]->killed() && !_periodic[i]->paused()) {
+      return _periodic[i]->slot();
+    }
+  }
+
+  // a task woken from an interrupt jumps the lottery
+  if (wake_task >= 0 && wake_task < (int)_tasks.Length() && _tasks[wake_task] && !_tasks[wake_task]->killed() && !_tasks[wake_task]->paused()) {
+    _pri[_tasks[wake_task]->priority()].current = wake_task;
+    return wake_task;
+  }
+
   unsigned weights[] = { 50, 33, 17 };
   const unsigned priCount = sizeof(weights) / sizeof(weights[0]);
   auto total = 0;
   for(unsigned i = 0; i < priCount; ++i) {
-    if (!_pri[i].count || (_pri[i].count == 1 && _pri[i].current == _yielded_task)) {
+    if (!_pri[i].count || (_pri[i].count == 1 && _pri[i].current == _isr.yielded)) {
       weights[i] = 0;
     }
     else {
@@ -73,7 +239,12 @@ int BTaskSwitcher::get_next_task() {
   }
 
   if (!total) {
-    return _current_task;
+    // nothing else to run, keep running the current task unless it can't run
+    auto current = _tasks[_isr.current];
+    if (_idle_task >= 0 && (current->paused() || current->killed())) {
+      return _idle_task;
+    }
+    return _isr.current;
   }
  
   unsigned dice = random(total);
@@ -91,7 +262,7 @@ int BTaskSwitcher::get_next_task() {
     if (next_task >= (int)_tasks.Length()) {
       next_task = 0;
     }
-  } while (next_task != _pri[pri].current && (next_task == _yielded_task || !_tasks[next_task] || _tasks[next_task]->id < 0 || _tasks[next_task]->priority() != pri || _tasks[next_task]->paused()));
+  } while (next_task != _pri[pri].current && (next_task == _isr.yielded || !_tasks[next_task] || _tasks[next_task]->killed() || _tasks[next_task]->priority() != pri || _tasks[next_task]->paused()));
   _pri[pri].current = next_task;
 
   return next_task;
@@ -99,81 +270,831 @@ int BTaskSwitcher::get_next_task() {
 
 void BTaskSwitcher::pause_task(int id) {
   BDisableInterrupts cli;
-  if (id >= 0 && id < (int)_tasks.Length() && _tasks[id] && !_tasks[id]->paused()) {
-    --_pri[_tasks[id]->priority()].count;
-    _tasks[id]->pause();
-    if (id == _current_task) {
+  auto slot = slot_of(id);
+  if (slot >= 0 && !_tasks[slot]->paused()) {
+    --_pri[_tasks[slot]->priority()].count;
+    _tasks[slot]->pause();
+    if (slot == _isr.current) {
       yield();
     }
   }
 }
 
+bool BTaskSwitcher::resume_slot(int slot) {
+  if (_tasks[slot]->paused()) {
+    ++_pri[_tasks[slot]->priority()].count;
+    _tasks[slot]->resume();
+#ifdef TASKFUN_LATENCY
+    mark_ready(_tasks[slot], micros());
+#endif
+    return true;
+  }
+  return false;
+}
+
 void BTaskSwitcher::resume_task(int id) {
   BDisableInterrupts cli;
-  if (id >= 0 && id < (int)_tasks.Length() && _tasks[id] && _tasks[id]->paused()) {
-    ++_pri[_tasks[id]->priority()].count;
-    _tasks[id]->resume();
+  auto slot = slot_of(id);
+  if (slot >= 0) {
+    resume_slot(slot);
+  }
+}
+
+void BTaskSwitcher::resume_task_isr(int id) {
+  BDisableInterrupts cli;
+  auto slot = slot_of(id);
+  if (slot >= 0 && resume_slot(slot)) {
+    wake_task(slot);
   }
 }
 
+void BTaskSwitcher::notify_task(int id, bool isr) {
+  BDisableInterrupts cli;
+  auto slot = slot_of(id);
+  if (slot >= 0) {
+    _tasks[slot]->notify();
+    if (_tasks[slot]->waiting() && resume_slot(slot) && isr) {
+      wake_task(slot);
+    }
+  }
+}
+
+void BTaskSwitcher::wait_notification() {
+  auto cli = disable();
+  auto task = _tasks[_isr.current];
+  while (!task->notified()) {
+    task->wait();
+    if (!task->paused()) {
+      --_pri[task->priority()].count;
+      task->pause();
+    }
+    yield_task();
+    // let a pending switch happen, then check again
+    restore(true);
+    disable();
+  }
+  task->clear_notify();
+  restore(cli);
+}
+
+// request a switch to the woken task when interrupt returns if it is at least
+// as important as the interrupted one
+void BTaskSwitcher::wake_task(int id) {
+  if (can_switch() && outranks(id, _isr.current)) {
+    _isr.wake = id;
+#ifndef TASKFUN_COOPERATIVE
+    // cooperative tasks pick up the woken task when they yield
+    if (!defer_locked()) {
+      defer_switch();
+    }
+#endif
+  }
+}
+
+unsigned long BTaskSwitcher::ticks() {
+  BDisableInterrupts cli;
+#ifdef TASKFUN_COOPERATIVE
+  advance_ticks();
+#endif
+  unsigned long t = _ticks;
+  return t;
+}
+
+// call with interrupts disabled to sleep atomically with the caller's check
+void BTaskSwitcher::sleep_until(unsigned long wake) {
+  auto cli = disable();
+  auto task = _tasks[_isr.current];
+  if ((long)(wake - _ticks) > 0) {
+    suspend_until(task, wake);
+    // resume_task() clears the sleep flag, either on wake up or early
+    while (task->sleeping()) {
+      yield_task();
+      restore(true);
+      disable();
+    }
+  }
+  restore(cli);
+}
+
+// called from the tick when the earliest sleeping task is due
+// must be called with interrupts disabled
+void BTaskSwitcher::suspend_until(BTaskInfoBase* task, unsigned long wake) {
+  if (!_sleeping || (long)(wake - _next_wake) < 0) {
+    _next_wake = wake;
+    _sleeping = true;
+  }
+  if (!task->paused()) {
+    --_pri[task->priority()].count;
+  }
+  task->pause();
+  task->sleep(wake);
+}
+
+void BTaskSwitcher::wake_sleeping() {
+  _sleeping = false;
+  for (unsigned i = 0; i < _tasks.Length(); ++i) {
+    auto task = _tasks[i];
+    if (task && !task->killed() && task->sleeping()) {
+      if ((long)(_ticks - task->wake) >= 0) {
+        resume_slot(i);
+        wake_task(i);
+      } else if (!_sleeping || (long)(task->wake - _next_wake) < 0) {
+        _next_wake = task->wake;
+        _sleeping = true;
+      }
+    }
+  }
+}
+
+// suspend the current task until ready(arg) returns true or the timeout expires,
+// ready() is called from the tick interrupt and must be short. Without ready()
+// the task waits until signal() is called for arg.
+bool BTaskSwitcher::wait_until(bool (*ready)(void*), void* arg, unsigned long timeout) {
+  if (!ready) {
+    if (!_initialized) {
+      return false;
+    }
+  } else if (!_initialized) {
+    // no scheduler yet, poll in place
+    auto start = millis();
+    while (!ready(arg)) {
+      if (timeout != Forever && millis() - start >= timeout) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  auto cli = disable();
+  auto result = ready && ready(arg);
+  auto deadline = _ticks + timeout;
+  auto task = _tasks[_isr.current];
+  while (!result && timeout) {
+    if (timeout != Forever) {
+      if ((long)(deadline - _ticks) <= 0) {
+        break;
+      }
+      suspend_until(task, deadline);
+    } else if (!task->paused()) {
+      --_pri[task->priority()].count;
+      task->pause();
+    }
+    task->poll(ready, arg);
+    _polling = _polling || ready;
+
+    // poll_tasks(), signal(), wake_sleeping() or resume_task() resume the task
+    while (task->paused()) {
+      yield_task();
+      restore(true);
+      disable();
+    }
+    auto signaled = !task->polling();
+    task->clear_poll();
+    if (!ready) {
+      result = signaled;
+      break;
+    }
+
+    // all tasks waiting for the predicate are resumed, another one may have
+    // made it false again before this task ran
+    result = ready(arg);
+  }
+  restore(cli);
+  return result;
+}
+
+void BTaskSwitcher::poll_tasks() {
+  _polling = false;
+  for (unsigned i = 0; i < _tasks.Length(); ++i) {
+    auto task = _tasks[i];
+    if (task && !task->killed() && task->polling() && task->paused() && task->ready) {
+      if (task->ready(task->ready_arg)) {
+        task->clear_poll();
+        resume_slot(i);
+        wake_task(i);
+      } else {
+        _polling = true;
+      }
+    }
+  }
+}
+
+// wake tasks whose wait condition became true without waiting for the tick,
+// must be called with interrupts disabled
+void BTaskSwitcher::wake_ready_tasks() {
+  if (_polling) {
+    poll_tasks();
+  }
+}
+
+// resume the highest priority task or all tasks waiting on object, must be
+// called with interrupts disabled
+void BTaskSwitcher::signal(void* object, bool all) {
+  int best = -1;
+  for (unsigned i = 0; i < _tasks.Length(); ++i) {
+    auto task = _tasks[i];
+    if (task && !task->killed() && task->polling() && task->paused() && !task->ready && task->ready_arg == object) {
+      if (all) {
+        task->clear_poll();
+        resume_slot(i);
+        wake_task(i);
+      } else if (best < 0 || !outranks(best, i)) {
+        best = i;
+      }
+    }
+  }
+
+  if (best >= 0) {
+    _tasks[best]->clear_poll();
+    resume_slot(best);
+    wake_task(best);
+  }
+}
+
+bool BTaskSwitcher::outranks(int id, int other) {
+  auto task = _tasks[id];
+  auto other_task = _tasks[other];
+  if (task->periodic || other_task->periodic) {
+    return task->periodic && (!other_task->periodic || precedes(task, other_task));
+  }
+  return task->priority() <= other_task->priority();
+}
+
+bool BTaskSwitcher::precedes(BTaskInfoBase* taskInfo, BTaskInfoBase* other) {
+  auto info = taskInfo->periodic;
+  auto other_info = other->periodic;
+  if (_policy == SchedulingPolicy::EarliestDeadline) {
+    return (long)((info->release + info->deadline) - (other_info->release + other_info->deadline)) < 0;
+  }
+  return info->period < other_info->period;
+}
+
+int BTaskSwitcher::start_task(BTaskInfoBase* taskInfo, uint8_t priority, BTaskWrapper wrapper) {
+  reap_tasks();
+
+  // the task is not visible to the scheduler yet, prepare it with interrupts enabled
+  taskInfo->priority(priority);
+  init_task(taskInfo, wrapper);
+
+  while (1) {
+    bool has_slot;
+    bool has_periodic;
+    unsigned capacity;
+    {
+      BDisableInterrupts cli;
+      has_slot = _free.Length() || _tasks.Length() < _tasks.Capacity();
+      has_periodic = !taskInfo->periodic || _periodic.Length() < _periodic.Capacity();
+      if (has_slot && has_periodic) {
+        return publish_task(taskInfo);
+      }
+      if (!has_slot && _tasks.Length() >= MaxTasks) {
+        break;
+      }
+      capacity = _tasks.Capacity() * 2;
+    }
+
+    // swap_stack() and release_slot() run with interrupts disabled and must not
+    // grow the reap and free lists, so they're never smaller than the task list
+    if (!has_slot) {
+      capacity = capacity > MaxTasks ? MaxTasks : capacity;
+      grow(_free, capacity);
+      grow(_reap, capacity);
+      grow(_tasks, capacity);
+    }
+    if (!has_periodic) {
+      grow(_periodic, _periodic.Capacity() ? _periodic.Capacity() * 2 : 2);
+    }
+  }
+
+  destroy_task(taskInfo);
+  return -1;
+}
+
+// make a prepared task visible to the scheduler, call with interrupts disabled
+// and enough capacity in the lists
+int BTaskSwitcher::publish_task(BTaskInfoBase* taskInfo) {
+  int id;
+  if (_free.Length()) {
+    id = _free[_free.Length() - 1];
+    _free.Remove(_free.Length() - 1);
+  } else {
+    id = _tasks.Length();
+    _tasks.Add(0);
+  }
+
+  unsigned new_task = id & SlotMask;
+  _tasks[new_task] = taskInfo;
+  taskInfo->id = id;
+
+  auto priority = taskInfo->priority();
+  if (!_pri[priority].count) {
+    _pri[priority].current = new_task;
+  };
+  ++_pri[priority].count;
+
+  if (taskInfo->periodic) {
+    add_periodic(taskInfo);
+  }
+#ifdef TASKFUN_LATENCY
+  mark_ready(taskInfo, micros());
+#endif
+  return id;
+}
+
+// keep periodic tasks ordered by the scheduling policy
+void BTaskSwitcher::add_periodic(BTaskInfoBase* taskInfo) {
+  BDisableInterrupts cli;
+  _periodic.Add(taskInfo);
+  auto i = _periodic.Length() - 1;
+  while (i > 0 && precedes(taskInfo, _periodic[i - 1])) {
+    _periodic[i] = _periodic[i - 1];
+    --i;
+  }
+  _periodic[i] = taskInfo;
+}
+
+void BTaskSwitcher::remove_periodic(BTaskInfoBase* taskInfo) {
+  for (unsigned i = 0; i < _periodic.Length(); ++i) {
+    if (_periodic[i] == taskInfo) {
+      _periodic.Remove(i);
+      break;
+    }
+  }
+}
+
+void BTaskSwitcher::complete_job(BTaskInfoBase* taskInfo) {
+  const unsigned window = 8;  // jobs
+  BDisableInterrupts cli;
+  auto info = taskInfo->periodic;
+  if ((long)(_ticks - (info->release + info->deadline)) > 0) {
+    ++info->missed;
+  }
+
+  if (++info->jobs % window == 0) {
+    info->load = (unsigned long)info->busy * 1000 / (window * info->period);
+    info->busy = 0;
+  }
+
+  info->release += info->period;
+  if (_policy == SchedulingPolicy::EarliestDeadline) {
+    // the next job has a later deadline
+    remove_periodic(taskInfo);
+    add_periodic(taskInfo);
+  }
+}
+
+void BTaskSwitcher::set_policy(uint8_t policy) {
+  BDisableInterrupts cli;
+  if (policy <= SchedulingPolicy::EarliestDeadline && policy != _policy) {
+    _policy = policy;
+    for (unsigned i = 1; i < _periodic.Length(); ++i) {
+      auto taskInfo = _periodic[i];
+      auto j = i;
+      while (j > 0 && precedes(taskInfo, _periodic[j - 1])) {
+        _periodic[j] = _periodic[j - 1];
+        --j;
+      }
+      _periodic[j] = taskInfo;
+    }
+  }
+}
+
+// CPU share of periodic tasks in permille, measured over the last jobs
+unsigned BTaskSwitcher::utilization() {
+  BDisableInterrupts cli;
+  unsigned load = 0;
+  for (unsigned i = 0; i < _periodic.Length(); ++i) {
+    load += _periodic[i]->periodic->load;
+  }
+  return load;
+}
+
+bool BTaskSwitcher::get_periodic_stats(int id, PeriodicStats& stats) {
+  BDisableInterrupts cli;
+  auto slot = slot_of(id);
+  if (slot >= 0 && _tasks[slot]->periodic) {
+    stats.jobs = _tasks[slot]->periodic->jobs;
+    stats.lateStarts = _tasks[slot]->periodic->late;
+    stats.missedDeadlines = _tasks[slot]->periodic->missed;
+    return true;
+  }
+  return false;
+}
+
+#ifdef TASKFUN_LATENCY
+// called with interrupts disabled
+void BTaskSwitcher::mark_ready(BTaskInfoBase* taskInfo, unsigned long now) {
+  taskInfo->latency.ready = now;
+  taskInfo->latency.queued = true;
+}
+
+// called from swap_stack() for the task being switched in
+void BTaskSwitcher::record_latency(BTaskInfoBase* taskInfo, unsigned long now) {
+  auto& latency = taskInfo->latency;
+  if (!latency.queued) {
+    return;
+  }
+  latency.queued = false;
+
+  auto elapsed = now - latency.ready;
+  uint8_t bucket = 0;
+  for (auto t = elapsed >> 1; t && bucket < TASKFUN_LATENCY_BUCKETS - 1; t >>= 1) {
+    ++bucket;
+  }
+
+  // halve all buckets when one fills up, keeping the shape of the histogram
+  if (latency.buckets[bucket] == 0xFFFF) {
+    for (uint8_t i = 0; i < TASKFUN_LATENCY_BUCKETS; ++i) {
+      latency.buckets[i] >>= 1;
+    }
+  }
+  ++latency.buckets[bucket];
+
+  if (!latency.count || elapsed < latency.shortest) {
+    latency.shortest = elapsed;
+  }
+  if (elapsed > latency.longest) {
+    latency.longest = elapsed;
+  }
+  ++latency.count;
+}
+
+bool BTaskSwitcher::get_latency_stats(int id, LatencyStats& stats) {
+  {
+    BDisableInterrupts cli;
+    auto slot = slot_of(id);
+    if (slot < 0) {
+      return false;
+    }
+    auto& latency = _tasks[slot]->latency;
+    stats.count = latency.count;
+    stats.minUs = latency.shortest;
+    stats.maxUs = latency.longest;
+    memcpy(stats.histogram, latency.buckets, sizeof(stats.histogram));
+  }
+
+  // walk down from the slowest bucket until 1% of the samples are above it
+  unsigned long total = 0;
+  for (uint8_t i = 0; i < TASKFUN_LATENCY_BUCKETS; ++i) {
+    total += stats.histogram[i];
+  }
+  unsigned long above = 0;
+  int bucket = TASKFUN_LATENCY_BUCKETS - 1;
+  while (bucket > 0 && (above + stats.histogram[bucket]) * 100 <= total) {
+    above += stats.histogram[bucket];
+    --bucket;
+  }
+  // the last bucket has no upper bound
+  stats.p99Us = bucket < TASKFUN_LATENCY_BUCKETS - 1 ? (2UL << bucket) - 1 : stats.maxUs;
+  if (stats.p99Us > stats.maxUs) {
+    stats.p99Us = stats.maxUs;
+  }
+  return true;
+}
+
+void BTaskSwitcher::reset_latency_stats(int id) {
+  BDisableInterrupts cli;
+  auto slot = slot_of(id);
+  if (slot >= 0) {
+    auto& latency = _tasks[slot]->latency;
+    latency.count = 0;
+    latency.shortest = 0;
+    latency.longest = 0;
+    memset(latency.buckets, 0, sizeof(latency.buckets));
+  }
+}
+#endif
+
+// called from the tick for the running task, a task that used up its budget
+// is paused until the next period and its slice is ended
+void BTaskSwitcher::charge_budget(BTaskInfoBase* taskInfo, unsigned long ticks) {
+  auto budget = taskInfo->budget;
+  if ((long)(_ticks - budget->replenish) >= 0) {
+    // periods in which the task didn't run are skipped, only the ticks since
+    // the start of the current period are charged to it
+    budget->used = 0;
+    budget->pending = false;
+    budget->replenish += ((_ticks - budget->replenish) / budget->period + 1) * budget->period;
+    auto since = _ticks - (budget->replenish - budget->period) + 1;
+    if (ticks > since) {
+      ticks = since;
+    }
+  }
+
+  // a task that is about to block is left alone
+  budget->used += ticks;
+  if (budget->used >= budget->ticks && !taskInfo->paused()) {
+    // a task holding the scheduler lock is throttled when it unlocks
+    if (taskInfo->lock) {
+      budget->pending = true;
+    } else {
+      throttle_task(taskInfo);
+    }
+  }
+}
+
+// pause a task that used up its budget until the next period
+void BTaskSwitcher::throttle_task(BTaskInfoBase* taskInfo) {
+  auto budget = taskInfo->budget;
+  ++budget->throttles;
+  suspend_until(taskInfo, budget->replenish);
+  _isr.slice = 0;
+}
+
+// a budget of 0 ticks removes the budget
+bool BTaskSwitcher::set_budget(int id, unsigned ticks, unsigned period) {
+  if (ticks > period) {
+    return false;
+  }
+
+  BBudget* budget = 0;
+  if (ticks) {
+    budget = (BBudget*)heap_alloc(sizeof(BBudget));
+    if (!budget) {
+      return false;
+    }
+    budget->ticks = ticks;
+    budget->period = period;
+    budget->used = 0;
+    budget->throttles = 0;
+    budget->pending = false;
+  }
+
+  bool found = false;
+  auto old = budget;
+  {
+    BDisableInterrupts cli;
+    auto slot = slot_of(id);
+    if (slot >= 0) {
+      auto taskInfo = _tasks[slot];
+      if (budget) {
+        budget->replenish = _ticks + period;
+      }
+      old = taskInfo->budget;
+      taskInfo->budget = budget;
+      found = true;
+    }
+  }
+
+  // the replaced budget, or the new one if the task doesn't exist
+  if (old) {
+    heap_free(old);
+  }
+  return found;
+}
+
+bool BTaskSwitcher::get_budget_stats(int id, BudgetStats& stats) {
+  BDisableInterrupts cli;
+  auto slot = slot_of(id);
+  if (slot >= 0 && _tasks[slot]->budget) {
+    auto budget = _tasks[slot]->budget;
+    stats.budgetMs = budget->ticks;
+    stats.periodMs = budget->period;
+    stats.usedMs = budget->used;
+    stats.throttles = budget->throttles;
+    return true;
+  }
+  return false;
+}
+
+void BTaskSwitcher::isr_yield() {
+#ifndef TASKFUN_COOPERATIVE
+  BDisableInterrupts cli;
+  if (_isr.wake >= 0 && can_switch() && !defer_locked()) {
+    schedule_task();
+  }
+#endif
+}
+
 uint8_t* BTaskSwitcher::swap_stack(uint8_t* sp) {
-  if (_tasks[_current_task]->id < 0) {
-    free_task(_current_task);
+  auto info = _isr.info;
+#ifdef TASKFUN_LATENCY
+  auto now = micros();
+#endif
+  if (info->killed()) {
+    _reap.Add(_isr.current);
   } else {
-    _tasks[_current_task]->sp = sp;
+    info->sp = sp;
+#ifdef TASKFUN_LATENCY
+    // a preempted task is ready again right away
+    if (!info->paused()) {
+      mark_ready(info, now);
+    }
+#endif
   }
 
-  _current_task = _next_task;
-  _yielded_task = -1;
-  _current_slice = _slice;
+  _isr.current = _isr.next;
+  _isr.info = _tasks[_isr.current];
+#ifdef TASKFUN_LATENCY
+  record_latency(_isr.info, now);
+#endif
+#ifdef TASKFUN_PROFILE_CLI
+  ++_switches;
+#endif
+  _isr.yielded = -1;
+  _isr.slice = _slice;
+  _switch_pending = false;
 
-  sp = _tasks[_current_task]->sp;
+  sp = _isr.info->sp;
   return sp;
 }
 
 void BTaskSwitcher::schedule_task() {
-  _next_task = get_next_task();
-  if (_next_task != _current_task) {
+  _isr.next = get_next_task();
+  if (_isr.next != _isr.current) {
     switch_context();
   }
 }
 
 bool BTaskSwitcher::can_switch() {
-  return _initialized && _current_task == _next_task;
+  return _initialized && _isr.current == _isr.next;
+}
+
+// a task holding the scheduler lock keeps running until it unlocks, unless it
+// blocks, the switch is made when the lock is released
+bool BTaskSwitcher::defer_locked() {
+  auto info = _isr.info;
+  if (info->lock && !info->paused() && !info->killed()) {
+    _switch_pending = true;
+    return true;
+  }
+  return false;
+}
+
+// only the task itself changes its lock depth, interrupts only read it
+// the barriers keep the compiler from moving the protected accesses outside
+// of the lock, the tick interrupt reads the depth
+void BTaskSwitcher::lock_scheduler() {
+  if (_initialized) {
+    ++_isr.info->lock;
+    asm volatile("" ::: "memory");
+  }
+}
+
+void BTaskSwitcher::unlock_scheduler() {
+  asm volatile("" ::: "memory");
+  if (_initialized && _isr.info->lock && !--_isr.info->lock && (_switch_pending || _isr.info->budget)) {
+    BDisableInterrupts cli;
+    auto info = _isr.info;
+    auto budget = info->budget;
+    if (budget && budget->pending) {
+      budget->pending = false;
+      // the budget may have been replenished meanwhile
+      if ((long)(_ticks - budget->replenish) < 0 && !info->paused()) {
+        throttle_task(info);
+      }
+    }
+    if (can_switch() && (_switch_pending || info->paused())) {
+      _switch_pending = false;
+      schedule_task();
+    }
+  }
+}
+
+// time accounting, the current task is charged for all the ticks
+void BTaskSwitcher::count_ticks(unsigned long ticks) {
+  _ticks += ticks;
+  if (_initialized) {
+    auto periodic = _isr.info->periodic;
+    if (periodic) {
+      periodic->busy += ticks;
+    }
+    if (_isr.info->budget) {
+      charge_budget(_isr.info, ticks);
+    }
+
+    auto idle = _isr.current == _idle_task;
+    if (ticks < LoadWindow - _load_ticks) {
+      _load_ticks += ticks;
+      if (idle) {
+        _idle_ticks += ticks;
+      }
+    } else {
+      // close the window, whole windows in between went to the same task
+      auto rest = ticks - (LoadWindow - _load_ticks);
+      if (idle) {
+        _idle_ticks = rest >= LoadWindow ? LoadWindow : _idle_ticks + LoadWindow - _load_ticks;
+      } else if (rest >= LoadWindow) {
+        _idle_ticks = 0;
+      }
+      _cpu_load = 100 - (unsigned long)_idle_ticks * 100 / LoadWindow;
+      _load_ticks = rest % LoadWindow;
+      _idle_ticks = idle ? _load_ticks : 0;
+    }
+  }
+}
+
+// resume the tasks whose sleep or wait is over
+void BTaskSwitcher::wake_due_tasks() {
+  if (_sleeping && (long)(_ticks - _next_wake) >= 0) {
+    wake_sleeping();
+  }
+  if (_polling) {
+    poll_tasks();
+  }
+}
+
+// ticks follow millis(), the AVR tick interrupt comes every 1.024ms and the
+// cooperative build has no tick interrupt and catches up whenever a task
+// yields. The elapsed time is charged to the current task in one step.
+void BTaskSwitcher::advance_ticks() {
+  unsigned long now = millis();
+  if (_ticks != now) {
+    count_ticks(now - _ticks);
+    wake_due_tasks();
+  }
 }
 
 void BTaskSwitcher::preempt_task() {
   BDisableInterrupts cli;
-  if (can_switch() && _current_slice <= 0) {
-    schedule_task();
-  } else {
-    --_current_slice;
+  advance_ticks();
+
+  if (can_switch() && (_isr.slice <= 0 || _isr.wake >= 0)) {
+    if (!defer_locked()) {
+      schedule_task();
+    }
+  } else if (_isr.slice > 0) {
+    --_isr.slice;
   }
 }
 
 void BTaskSwitcher::yield_task() {
   BDisableInterrupts cli;
-  if (can_switch()) {
-    _yielded_task = _current_task;
+#ifdef TASKFUN_COOPERATIVE
+  advance_ticks();
+#endif
+  if (can_switch() && !defer_locked()) {
+    _isr.yielded = _isr.current;
     schedule_task();
   }
 }
 
+bool BTaskSwitcher::can_initialize(int slice, uint8_t loop_pri) {
+  return !_initialized && slice > 0 && (BSlice)slice == slice && loop_pri <= TaskPriority::Low;
+}
+
+// call with interrupts disabled and room for loop() in the task list
+void BTaskSwitcher::start_scheduler(BTaskInfoBase* loop, int slice, uint8_t loop_pri) {
+  _slice = slice;
+
+  // add the initial loop() task, loop() already has a stack
+  _tasks.Add(loop);
+  loop->id = 0;
+  loop->priority(loop_pri);
+  _pri[loop->priority()].count = 1;
+  _isr.info = loop;
+
+  init_arch();
+  _ticks = millis();
+
+  _initialized = true;
+}
+
+// the idle task is not in any queue, it's only picked when no task can run
+void BTaskSwitcher::set_idle(int id) {
+  if (id >= 0) {
+    _idle_task = id & SlotMask;
+    _tasks[_idle_task]->pause();
+    --_pri[TaskPriority::Low].count;
+  }
+}
+
 void BTaskSwitcher::initialize(int tasks, int slice, uint8_t loop_pri) {
   BDisableInterrupts cli;
-  if (!_initialized && tasks > 0 && slice > 0 && loop_pri <= TaskPriority::Low) {
-    _slice = slice;
-    _tasks.Resize(tasks + 1);  // 1 for main loop()
+  if (can_initialize(slice, loop_pri) && tasks > 0 && tasks <= MaxTasks - 2) {
+    _tasks.Resize(tasks + 2);  // 1 for main loop() and 1 for idle
+    _free.Resize(tasks + 2);
+    _reap.Resize(tasks + 2);
+    start_scheduler(new BTaskInfoBase(), slice, loop_pri);
+
+    auto idle = BTask<int>(idle_task);
+    int arg = 0;
+    set_idle(run_task(idle, arg, TASKFUN_IDLE_STACK, TaskPriority::Low));
+  }
+}
 
-    // add the initial loop() task
-    _tasks.Add(new BTaskInfoBase());  // loop() already has a stack
-    _tasks[0]->id = 0;
-    _tasks[0]->priority(loop_pri);
-    _pri[_tasks[0]->priority()].count = 1;
+// starts the tasks of a static table, the lists, control blocks and stacks are
+// all in the table so nothing is allocated
+void BTaskSwitcher::initialize(BStaticTable& table, int slice, uint8_t loop_pri) {
+  BDisableInterrupts cli;
+  if (can_initialize(slice, loop_pri) && table.capacity <= MaxTasks) {
+    _tasks.Attach(table.tasks, table.capacity);
+    _free.Attach(table.free, table.capacity);
+    _reap.Attach(table.reap, table.capacity);
+    start_scheduler(table.loop, slice, loop_pri);
 
-    init_arch();
+    for (uint8_t i = 0; i < table.count; ++i) {
+      publish_task(table.initial[i]);
+    }
+    set_idle(publish_task(table.idle));
+  }
+}
 
-    _initialized = true;
+void BTaskSwitcher::idle_task(int) {
+  while (1) {
+    reap_tasks();
+    onIdle();
+    yield_task();
   }
 }
 
@@ -193,6 +1114,78 @@ void resumeTask(int id) {
   BTaskSwitcher::resume_task(id);
 }
 
+void resumeTaskFromISR(int id) {
+  BTaskSwitcher::resume_task_isr(id);
+}
+
+void notifyTask(int id) {
+  BTaskSwitcher::notify_task(id, false);
+}
+
+void notifyFromISR(int id) {
+  BTaskSwitcher::notify_task(id, true);
+}
+
+void waitNotification() {
+  BTaskSwitcher::wait_notification();
+}
+
+void yieldFromISR() {
+  BTaskSwitcher::isr_yield();
+}
+
+bool getPeriodicStats(int id, PeriodicStats& stats) {
+  return BTaskSwitcher::get_periodic_stats(id, stats);
+}
+
+bool setTaskBudget(int id, unsigned budgetMs, unsigned periodMs) {
+  return BTaskSwitcher::set_budget(id, budgetMs, periodMs);
+}
+
+bool getBudgetStats(int id, BudgetStats& stats) {
+  return BTaskSwitcher::get_budget_stats(id, stats);
+}
+
+void setSchedulingPolicy(uint8_t policy) {
+  BTaskSwitcher::set_policy(policy);
+}
+
+unsigned getUtilization() {
+  return BTaskSwitcher::utilization() / 10;
+}
+
+bool isOverloaded() {
+  return BTaskSwitcher::utilization() > 1000;
+}
+
+bool waitUntil(bool (*predicate)(void*), void* arg, unsigned long timeoutMs) {
+  return predicate && BTaskSwitcher::wait_until(predicate, arg, timeoutMs);
+}
+
+static bool call_predicate(void* predicate) {
+  return ((bool (*)())predicate)();
+}
+
+bool waitUntil(bool (*predicate)(), unsigned long timeoutMs) {
+  return predicate && BTaskSwitcher::wait_until(call_predicate, (void*)predicate, timeoutMs);
+}
+
+void sleepTask(unsigned long ms) {
+  BTaskSwitcher::sleep_until(BTaskSwitcher::ticks() + ms);
+}
+
+void* getTaskLocal(uint8_t slot) {
+  auto taskInfo = BTaskSwitcher::current_info();
+  return taskInfo && slot < TASKFUN_LOCAL_SLOTS ? taskInfo->local[slot] : 0;
+}
+
+void setTaskLocal(uint8_t slot, void* value) {
+  auto taskInfo = BTaskSwitcher::current_info();
+  if (taskInfo && slot < TASKFUN_LOCAL_SLOTS) {
+    taskInfo->local[slot] = value;
+  }
+}
+
 int currentTask() {
   return BTaskSwitcher::current_task_id();
 }
@@ -201,6 +1194,41 @@ void setupTasks(int numTasks, int msSlice, uint8_t loopPriority) {
   BTaskSwitcher::initialize(numTasks, msSlice, loopPriority);
 }
 
+#ifdef TASKFUN_PROFILE_CLI
+void printInterruptProfile(Print& out, uint8_t count) {
+  BTaskSwitcher::print_cli_profile(out, count);
+}
+
+void resetInterruptProfile() {
+  BTaskSwitcher::reset_cli_profile();
+}
+#endif
+
+#ifdef TASKFUN_LATENCY
+bool getLatencyStats(int id, LatencyStats& stats) {
+  return BTaskSwitcher::get_latency_stats(id, stats);
+}
+
+void resetLatencyStats(int id) {
+  BTaskSwitcher::reset_latency_stats(id);
+}
+#endif
+
+uint8_t getCpuLoad() {
+  return BTaskSwitcher::_cpu_load;
+}
+
+void __attribute__((weak)) onIdle() {
+}
+
+void lockScheduler() {
+  BTaskSwitcher::lock_scheduler();
+}
+
+void unlockScheduler() {
+  BTaskSwitcher::unlock_scheduler();
+}
+
 // used by arduino's delay()
 void yield() {
   BTaskSwitcher::yield_task();
@@ -3,38 +3,192 @@
 
 #include "BTask.h"
 #include "BList.h"
+#include "BTuple.h"
 #include "BTaskSwitcherSAMD.h"
 #include "BTaskSwitcherAVR.h"
 
 __BTASKSWITCHER_ARCH_HEADER__
 
+// number of task-local pointer slots per task
+#ifndef TASKFUN_LOCAL_SLOTS
+#define TASKFUN_LOCAL_SLOTS 2
+#endif
+
+// define TASKFUN_PROFILE_CLI to measure how long each critical section keeps
+// interrupts disabled, TASKFUN_PROFILE_SITES is the number of call sites tracked
+#if defined(TASKFUN_PROFILE_CLI) && !defined(TASKFUN_PROFILE_SITES)
+#define TASKFUN_PROFILE_SITES 12
+#endif
+
+// define TASKFUN_LATENCY to record how long each task waits between becoming
+// ready and running, in a log2 histogram of microseconds
+#if defined(TASKFUN_LATENCY) && !defined(TASKFUN_LATENCY_BUCKETS)
+#define TASKFUN_LATENCY_BUCKETS 16
+#endif
+
+// define TASKFUN_COOPERATIVE to only switch tasks in yield(), delay() and
+// blocking calls, there is no tick interrupt and SyncVar<> doesn't disable
+// interrupts
+
+// 8-bit scheduler state, on by default on 8-bit targets
+#ifndef TASKFUN_COMPACT
+#ifdef ARDUINO_ARCH_AVR
+#define TASKFUN_COMPACT 1
+#else
+#define TASKFUN_COMPACT 0
+#endif
+#endif
+
+// stack size of the idle task which runs onIdle()
+#ifndef TASKFUN_IDLE_STACK
+#define TASKFUN_IDLE_STACK (64 * sizeof(int))
+#endif
+
+class Print;
+
 struct TaskPriority {
   static const int High = 0;
   static const int Medium = 1;
   static const int Low = 2;
 };
 
+struct TaskTimeout {
+  static const unsigned long Forever = ~0UL;
+};
+
+struct SchedulingPolicy {
+  static const uint8_t RateMonotonic = 0;
+  static const uint8_t EarliestDeadline = 1;
+};
+
+struct PeriodicStats {
+  unsigned long jobs;
+  unsigned lateStarts;
+  unsigned missedDeadlines;
+};
+
+struct BudgetStats {
+  unsigned budgetMs;  // CPU time allowed per period
+  unsigned periodMs;
+  unsigned usedMs;    // used in the current period
+  unsigned long throttles;
+};
+
+#ifdef TASKFUN_LATENCY
+// bucket i counts latencies from 2^i to 2^(i+1)-1us, bucket 0 also counts 0
+struct LatencyStats {
+  unsigned long count;
+  unsigned long minUs;
+  unsigned long maxUs;
+  unsigned long p99Us;  // upper bound of the bucket holding the 99th percentile
+  uint16_t histogram[TASKFUN_LATENCY_BUCKETS];
+};
+#endif
+
 template<typename T>
-int runTask(void (*task)(T& arg), T& arg, unsigned stackSize = 256 * sizeof(int), uint8_t priority = 1);
+int runTask(void (*task)(T& arg), T& arg, unsigned stackSize = 256 * sizeof(int), uint8_t priority = 1, unsigned arenaSize = 0);
 template<typename T, typename U>
-int runTask(const T* instance, void (T::*task)(U& arg), U& arg, unsigned stackSize = 256 * sizeof(int), uint8_t priority = 1);
+int runTask(const T* instance, void (T::*task)(U& arg), U& arg, unsigned stackSize = 256 * sizeof(int), uint8_t priority = 1, unsigned arenaSize = 0);
 template<typename T>
-int runTask(void (*task)(T arg), T arg, unsigned stackSize = 256 * sizeof(int), uint8_t priority = 1);
+int runTask(void (*task)(T arg), T arg, unsigned stackSize = 256 * sizeof(int), uint8_t priority = 1, unsigned arenaSize = 0);
 template<typename T, typename U>
-int runTask(const T* instance, void (T::*task)(U arg), U arg, unsigned stackSize = 256 * sizeof(int), uint8_t priority = 1);
+int runTask(const T* instance, void (T::*task)(U arg), U arg, unsigned stackSize = 256 * sizeof(int), uint8_t priority = 1, unsigned arenaSize = 0);
+template<typename... Params, typename... Args>
+int emplaceTask(unsigned stackSize, uint8_t priority, void (*task)(Params...), Args&&... args);
+template<typename T>
+int runPeriodicTask(void (*task)(T& arg), T& arg, unsigned long periodMs, unsigned long deadlineMs = 0, unsigned stackSize = 256 * sizeof(int));
+template<typename T>
+int runPeriodicTask(void (*task)(T arg), T arg, unsigned long periodMs, unsigned long deadlineMs = 0, unsigned stackSize = 256 * sizeof(int));
+bool getPeriodicStats(int id, PeriodicStats& stats);
+bool setTaskBudget(int id, unsigned budgetMs, unsigned periodMs);
+bool getBudgetStats(int id, BudgetStats& stats);
+void setSchedulingPolicy(uint8_t policy);
+unsigned getUtilization();
+bool isOverloaded();
 void stopTask(int id);
 int currentTask();
 void pauseTask(int id);
 void resumeTask(int id);
+void resumeTaskFromISR(int id);
+void notifyTask(int id);
+void notifyFromISR(int id);
+void waitNotification();
+void sleepTask(unsigned long ms);
+bool waitUntil(bool (*predicate)(void*), void* arg, unsigned long timeoutMs = TaskTimeout::Forever);
+bool waitUntil(bool (*predicate)(), unsigned long timeoutMs = TaskTimeout::Forever);
+void* getTaskLocal(uint8_t slot);
+void setTaskLocal(uint8_t slot, void* value);
+void yieldFromISR();
+void lockScheduler();
+void unlockScheduler();
 void setupTasks(int numTasks = 3, int msSlice = 1, uint8_t loopPriority = 1);
+uint8_t getCpuLoad();
+void onIdle();
+#ifdef TASKFUN_PROFILE_CLI
+void printInterruptProfile(Print& out, uint8_t count = 5);
+void resetInterruptProfile();
+#endif
+#ifdef TASKFUN_LATENCY
+bool getLatencyStats(int id, LatencyStats& stats);
+void resetLatencyStats(int id);
+#endif
 
 extern "C" void yield();
 
+// keeps the current task running until it goes out of scope, interrupts stay
+// enabled
+class SchedulerLock {
+public:
+  SchedulerLock() {
+    lockScheduler();
+  }
+
+  ~SchedulerLock() {
+    unlockScheduler();
+  }
+};
+
+template<typename T, typename Lock>
+class SyncVar;
+class TaskStream;
+class ConditionVariable;
+class TaskLogBase;
+template<unsigned Size, uint8_t Count>
+class BufferPool;
+template<typename T, uint8_t Count>
+class Channel;
+template<typename T, uint8_t Count>
+class Topic;
+template<typename T, unsigned StackSize>
+class StaticTask;
+template<uint8_t Count>
+class TaskTable;
+
 namespace Buratino {
 
 class BTaskSwitcher {
 protected:
+  // task id is the slot in the task list plus a generation count of the slot
+  static const int SlotBits = 7;
+  static const int SlotMask = (1 << SlotBits) - 1;
+  static const int GenerationMask = 0xFF;
+  static const int MaxTasks = 1 << SlotBits;
+  static const unsigned LoadWindow = 1000;  // ticks
+  static const unsigned long Forever = TaskTimeout::Forever;
+
+  // task slots always fit 8 bits, the compact configuration uses 8-bit slots
+  // and slice counters so the tick and the switch use single byte operations
+#if TASKFUN_COMPACT
+  typedef int8_t BSlot;
+  typedef int8_t BSlice;
+#else
+  typedef int BSlot;
+  typedef int BSlice;
+#endif
+
+
   /* RAII to disable/restore interrups */
+#ifndef TASKFUN_PROFILE_CLI
   class BDisableInterrupts {
   public:
     BDisableInterrupts();
@@ -42,17 +196,117 @@ protected:
   protected:
     bool enabled;
   };
+#else
+  /* instrumented version, tagged with the call site or a user tag */
+  class BDisableInterrupts {
+  public:
+    BDisableInterrupts(const char* tag = __builtin_FILE(), int line = __builtin_LINE());
+    ~BDisableInterrupts();
+  protected:
+    bool enabled;
+    const char* tag;
+    int line;
+    uint8_t switches;
+    unsigned long start;
+  };
+
+  struct BCliSite {
+    const char* tag;
+    int line;
+    unsigned long max;
+    unsigned long total;
+    unsigned long count;
+  };
+
+  static BCliSite _cli_sites[TASKFUN_PROFILE_SITES];
+  static volatile uint8_t _switches;
+
+  // CPU cycle counter of the architecture, micros() is too coarse
+  static unsigned long cycle_count();
+  static unsigned long cycles_since(unsigned long start);
+  static void record_cli(const char* tag, int line, unsigned long elapsed);
+  static void print_cli_profile(Print& out, uint8_t count);
+  static void reset_cli_profile();
+
+  friend void ::printInterruptProfile(Print&, uint8_t);
+  friend void ::resetInterruptProfile();
+#endif
+
+  struct BPeriodic {
+    unsigned long period;
+    unsigned long deadline;  // relative to release
+    unsigned long release;   // absolute tick of the next job
+    unsigned long jobs;
+    unsigned late;
+    unsigned missed;
+    unsigned busy;  // ticks used by the jobs in the current window
+    unsigned load;  // permille of the CPU used in the last window
+  };
+
+  // CPU time a task may use per period, the task is paused until the next
+  // period once it's used up
+  struct BBudget {
+    unsigned ticks;
+    unsigned period;
+    unsigned used;
+    unsigned long replenish;  // absolute tick of the next period
+    unsigned long throttles;
+    bool pending;  // used up while the task held the scheduler lock
+  };
+
+  // private heap of a task carved from the task's block, allocations are
+  // bumped from the start and all freed when the task exits
+  struct BArena {
+    uint8_t* data;
+    unsigned size;
+    unsigned used;
+    uint8_t bypass;  // allocate from the global heap while non-zero
+    BArena* next;    // list of live arenas
+  };
+
+#ifdef TASKFUN_LATENCY
+  struct BLatency {
+    unsigned long ready;  // micros() when the task became ready
+    bool queued;          // ready and waiting to run
+    unsigned long count;
+    unsigned long shortest;
+    unsigned long longest;
+    uint16_t buckets[TASKFUN_LATENCY_BUCKETS];
+
+    BLatency()
+      : ready(0), queued(false), count(0), shortest(0), longest(0), buckets() {}
+  };
+#endif
 
   struct BTaskInfoBase {
     enum {
       fPriorityMask = 0x03,
+      fKill = 0x04,
       fPause = 0x08,
+      fNotify = 0x10,
+      fWait = 0x20,
+      fSleep = 0x40,
+      fPoll = 0x80,
     };
 
     uint8_t* sp;
     int id;
-    uint8_t flags;
-    virtual ~BTaskInfoBase() {}
+    uint8_t flags;  // priority and state bits
+    volatile uint8_t lock;  // scheduler lock depth
+    void (*destroy)(BTaskInfoBase*);  // runs the destructor of the derived info and frees it
+    unsigned long wake;
+    BPeriodic* periodic;  // null for regular tasks
+    BArena* arena;        // null if the task has no arena
+    BBudget* budget;      // null if the task has no CPU budget
+    bool (*ready)(void*);  // polled on the tick while the task waits
+    void* ready_arg;
+    void* local[TASKFUN_LOCAL_SLOTS];
+#ifdef TASKFUN_LATENCY
+    BLatency latency;
+#endif
+
+    BTaskInfoBase()
+      : sp(0), id(0), flags(0), lock(0), destroy(0), wake(0), periodic(0), arena(0), budget(0), ready(0), ready_arg(0), local() {}
 
     static void* operator new(size_t size) {
         return ::operator new(size);
@@ -62,6 +316,10 @@ protected:
       return where;
     }
 
+    unsigned slot() {
+      return id & SlotMask;
+    }
+
     uint8_t priority() {
       return flags & fPriorityMask;
     }
@@ -70,6 +328,14 @@ protected:
       flags |= p & fPriorityMask;
     }
 
+    void kill() {
+      flags |= fKill;
+    }
+
+    bool killed() {
+      return flags & fKill;
+    }
+
     void pause() {
       flags |= fPause;
     }
@@ -79,7 +345,50 @@ protected:
     }
 
     void resume() {
-      flags &= ~fPause;
+      flags &= ~(fPause | fSleep);
+    }
+
+    void sleep(unsigned long at) {
+      wake = at;
+      flags |= fSleep;
+    }
+
+    bool sleeping() {
+      return flags & fSleep;
+    }
+
+    void poll(bool (*fn)(void*), void* arg) {
+      ready = fn;
+      ready_arg = arg;
+      flags |= fPoll;
+    }
+
+    bool polling() {
+      return flags & fPoll;
+    }
+
+    void clear_poll() {
+      flags &= ~fPoll;
+    }
+
+    void notify() {
+      flags |= fNotify;
+    }
+
+    bool notified() {
+      return flags & fNotify;
+    }
+
+    void wait() {
+      flags |= fWait;
+    }
+
+    bool waiting() {
+      return flags & fWait;
+    }
+
+    void clear_notify() {
+      flags &= ~(fNotify | fWait);
     }
   };
 
@@ -90,34 +399,165 @@ protected:
     BTaskInfo(BTask<T>& task, T& argument) : delegate(task), arg(argument) { }
   };
 
+  // calls a plain function rather than a delegate, so it needs no heap
+  template<typename T>
+  struct BStaticTaskInfo : BTaskInfoBase {
+    void (*function)(T);
+    T arg;
+    BStaticTaskInfo(void (*task)(T), T argument) : function(task), arg(argument) { }
+  };
+
+  // arguments are constructed in place and passed to the task without copies
+  template<typename... Params>
+  struct BEmplaceTaskInfo : BTaskInfoBase {
+    void (*function)(Params...);
+    BTuple<typename BDecay<Params>::Type...> args;
+
+    template<typename... Args>
+    BEmplaceTaskInfo(void (*task)(Params...), Args&&... arguments) : function(task), args(BForward<Args>(arguments)...) { }
+
+    // by value parameters are moved from the stored arguments
+    template<unsigned... I>
+    void call(BIndices<I...>) {
+      function(BForward<Params>(BTupleElement<I, typename BDecay<Params>::Type...>::get(args))...);
+    }
+  };
+
+  // storage of a task table declared at compile time
+  struct BStaticTable {
+    BTaskInfoBase** tasks;  // the lists have room for loop(), the idle task
+    int* free;              // and the static tasks
+    BSlot* reap;
+    unsigned capacity;
+    BTaskInfoBase* loop;
+    BTaskInfoBase* idle;
+    BTaskInfoBase** initial;  // the static tasks, started in order
+    uint8_t count;
+  };
+
+  template<typename T, typename U>
+  struct BPeriodicTaskInfo : BTaskInfo<T, U> {
+    BPeriodic info;
+    BPeriodicTaskInfo(BTask<T>& task, T& argument) : BTaskInfo<T, U>(task, argument), info() {
+      this->periodic = &info;
+    }
+  };
+
   struct BSwitchState {
-    int current;
+    BSlot current;
     unsigned count;
   };
 
+  // state used by the tick and the context switch, kept together so it's
+  // addressed from one base pointer
+  struct BIsrState {
+    BTaskInfoBase* info;  // _tasks[current]
+    BSlot current;
+    BSlot next;
+    BSlot yielded;
+    BSlot wake;
+    BSlice slice;  // ticks left in the current slice
+  };
+
   typedef void (*BTaskWrapper)(BTaskInfoBase*);
 
 protected:
   static volatile bool _initialized;
   static BList<BTaskInfoBase*> _tasks;
-  static volatile int _current_task;
-  static volatile int _next_task;
-  static volatile int _yielded_task;
-  static volatile int _current_slice;
-  static int _slice;
+  static BList<int> _free;  // ids for the free slots
+  static BList<BSlot> _reap;  // slots of exited tasks to free
+  static volatile BIsrState _isr;
+  static BSlot _idle_task;
+  static unsigned _idle_ticks;
+  static unsigned _load_ticks;
+  static volatile uint8_t _cpu_load;
+  static volatile unsigned long _ticks;
+  static volatile unsigned long _next_wake;
+  static volatile bool _sleeping;
+  static volatile bool _polling;
+  static volatile bool _switch_pending;  // a switch was held back by the scheduler lock
+  static BArena* _arenas;  // arenas of the live tasks, guarded by the scheduler lock
+  static BSlice _slice;
   static BSwitchState _pri[3];
+  static BList<BTaskInfoBase*> _periodic;  // sorted by period or by job deadline
+  static uint8_t _policy;
 
 protected:
   static int current_task_id();
-  static void free_task(int id);
+
+  // only changes when the task is switched out, the running task always reads
+  // its own task info without a critical section
+  static BTaskInfoBase* current_info() {
+    return _isr.info;
+  }
+
+  // allocations of the current task skip its arena while in scope
+  class BGlobalHeap {
+  public:
+    BGlobalHeap();
+    ~BGlobalHeap();
+  protected:
+    BArena* arena;
+  };
+
+  static void* heap_alloc(size_t size);
+  static void heap_free(void* ptr);
+  static unsigned arena_block_size(unsigned size);
+  static BArena* init_arena(uint8_t* block, unsigned size);
+  static void release_arena(BArena* arena);
+
+  static int slot_of(int id);
+  static void release_slot(int slot);
+  static void destroy_task(BTaskInfoBase* taskInfo);
+  static void reap_tasks();
+  static void idle_task(int);
   static int get_next_task();
   static unsigned context_size();
   static bool disable();
   static void restore(bool enable);
+  static bool can_initialize(int slice, uint8_t loop_pri);
+  static void start_scheduler(BTaskInfoBase* loop, int slice, uint8_t loop_pri);
+  static void set_idle(int id);
   static void initialize(int tasks, int slice, uint8_t loop_pri);
+  static void initialize(BStaticTable& table, int slice, uint8_t loop_pri);
   static void yield_task();
   static void pause_task(int id);
+  static bool resume_slot(int slot);
   static void resume_task(int id);
+  static void resume_task_isr(int id);
+  static void notify_task(int id, bool isr);
+  static void wait_notification();
+  static void wake_task(int id);
+  static bool outranks(int id, int other);
+  static int start_task(BTaskInfoBase* taskInfo, uint8_t priority, BTaskWrapper wrapper);
+  static int publish_task(BTaskInfoBase* taskInfo);
+  static bool precedes(BTaskInfoBase* taskInfo, BTaskInfoBase* other);
+  static void add_periodic(BTaskInfoBase* taskInfo);
+  static void complete_job(BTaskInfoBase* taskInfo);
+  static void set_policy(uint8_t policy);
+  static unsigned utilization();
+  static void remove_periodic(BTaskInfoBase* taskInfo);
+  static bool get_periodic_stats(int id, PeriodicStats& stats);
+  static bool set_budget(int id, unsigned ticks, unsigned period);
+  static bool get_budget_stats(int id, BudgetStats& stats);
+  static void charge_budget(BTaskInfoBase* taskInfo, unsigned long ticks);
+  static void throttle_task(BTaskInfoBase* taskInfo);
+#ifdef TASKFUN_LATENCY
+  static void mark_ready(BTaskInfoBase* taskInfo, unsigned long now);
+  static void record_latency(BTaskInfoBase* taskInfo, unsigned long now);
+  static bool get_latency_stats(int id, LatencyStats& stats);
+  static void reset_latency_stats(int id);
+#endif
+  static void defer_switch();
+  static void isr_yield();
+  static unsigned long ticks();
+  static void sleep_until(unsigned long wake);
+  static void suspend_until(BTaskInfoBase* task, unsigned long wake);
+  static void wake_sleeping();
+  static bool wait_until(bool (*ready)(void*), void* arg, unsigned long timeout);
+  static void poll_tasks();
+  static void wake_ready_tasks();
+  static void signal(void* object, bool all);
   static void kill_task(int id);
   static void init_arch();
   static void init_task(BTaskInfoBase* taskInfo, BTaskWrapper wrapper);
@@ -125,25 +565,77 @@ protected:
   static void switch_context();
   static void schedule_task();
   static bool can_switch();
+  static bool defer_locked();
+  static void lock_scheduler();
+  static void unlock_scheduler();
+  static void count_ticks(unsigned long ticks);
+  static void wake_due_tasks();
+  static void advance_ticks();
   static void preempt_task();
 
-  template<typename T, typename U>
-  static BTaskInfoBase* alloc_task(BTask<T>& task, U& arg, unsigned stackSize) {
-    auto size = sizeof(BTaskInfo<T, U>) + stackSize + context_size();
-    auto block = new uint8_t[size];
-    auto taskInfo = new (block) BTaskInfo<T, U>(task, arg);
+  // grow a list used by the scheduler, only the copy disables interrupts
+  template<typename T>
+  static void grow(BList<T>& list, unsigned capacity) {
+    auto array = new T[capacity];
+    {
+      BDisableInterrupts cli;
+      if (list.Capacity() < capacity) {
+        array = list.Reserve(array, capacity);
+      }
+    }
+    delete[] array;
+  }
+
+  // a function per task type instead of a virtual destructor, saves the
+  // vtables which are in RAM on AVR
+  template<typename TInfo>
+  static void destroy_info(BTaskInfoBase* taskInfo) {
+    auto arena = taskInfo->arena;
+    ((TInfo*)taskInfo)->~TInfo();
+    if (arena) {
+      release_arena(arena);
+    }
+    heap_free(taskInfo);
+  }
+
+  // static tasks keep their storage, their slot is reused
+  template<typename TInfo>
+  static void destroy_static(BTaskInfoBase* taskInfo) {
+    ((TInfo*)taskInfo)->~TInfo();
+  }
+
+  // task blocks always come from the global heap, never from an arena
+  template<typename TInfo, typename... Args>
+  static TInfo* alloc_info(unsigned stackSize, unsigned arenaSize, Args&&... args) {
+    auto arena_size = arena_block_size(arenaSize);
+    auto size = sizeof(TInfo) + arena_size + stackSize + context_size();
+    auto block = (uint8_t*)heap_alloc(size);
+    if (!block) {
+      return 0;
+    }
+
+    auto taskInfo = new (block) TInfo(BForward<Args>(args)...);
     taskInfo->sp = &block[size - 1];
+    taskInfo->destroy = destroy_info<TInfo>;
+    if (arena_size) {
+      taskInfo->arena = init_arena(block + sizeof(TInfo), arena_size);
+    }
     return taskInfo;
   }
 
+  template<typename T, typename U>
+  static BTaskInfoBase* alloc_task(BTask<T>& task, U& arg, unsigned stackSize, unsigned arenaSize) {
+    return alloc_info<BTaskInfo<T, U> >(stackSize, arenaSize, task, arg);
+  }
+
   template<typename T>
-  static BTaskInfoBase* alloc_task(BTask<T&>& task, T& arg, unsigned stackSize) {
-    return alloc_task<T&, T>(task, arg, stackSize);
+  static BTaskInfoBase* alloc_task(BTask<T&>& task, T& arg, unsigned stackSize, unsigned arenaSize) {
+    return alloc_task<T&, T>(task, arg, stackSize, arenaSize);
   }
 
   template<typename T>
-  static BTaskInfoBase* alloc_task(BTask<T>& task, T& arg, unsigned stackSize) {
-    return alloc_task<T, T>(task, arg, stackSize);
+  static BTaskInfoBase* alloc_task(BTask<T>& task, T& arg, unsigned stackSize, unsigned arenaSize) {
+    return alloc_task<T, T>(task, arg, stackSize, arenaSize);
   }
 
   template<typename T, typename U>
@@ -152,63 +644,157 @@ protected:
     kill_task(current_task_id());
   }
 
+  template<typename T>
+  static void static_wrapper(BStaticTaskInfo<T>* taskInfo) {
+    taskInfo->function(taskInfo->arg);
+    kill_task(current_task_id());
+  }
+
+  template<typename... Params>
+  static void emplace_wrapper(BEmplaceTaskInfo<Params...>* taskInfo) {
+    taskInfo->call(typename BMakeIndices<sizeof...(Params)>::Type());
+    kill_task(current_task_id());
+  }
+
   template<typename T, typename U>
-  static int run_task(BTask<T>& task, U& arg, unsigned stackSize, uint8_t priority) {
-    BDisableInterrupts cli;
+  static void periodic_wrapper(BPeriodicTaskInfo<T, U>* taskInfo) {
+    auto& info = taskInfo->info;
+    while (1) {
+      // released by the tick at an absolute time, no drift
+      sleep_until(info.release);
+      if ((long)(ticks() - info.release) > 0) {
+        ++info.late;
+      }
+
+      taskInfo->delegate(taskInfo->arg);
+      complete_job(taskInfo);
+    }
+  }
+
+  template<typename T, typename U>
+  static int run_task(BTask<T>& task, U& arg, unsigned stackSize, uint8_t priority, unsigned arenaSize = 0) {
     if (!_initialized || priority > TaskPriority::Low || !stackSize) {
       return -1;
     }
 
-    unsigned new_task = 0;
-    while (new_task < _tasks.Length() && _tasks[new_task]) {
-      ++new_task;
+    auto taskInfo = alloc_task(task, arg, stackSize, arenaSize);
+    if (!taskInfo) {
+      return -1;
+    }
+    return start_task(taskInfo, priority, (BTaskWrapper)task_wrapper<typename BTask<T>::ArgumentType, U>);
+  }
+
+  template<typename T>
+  static int run_task(BTask<T>& task, T& arg, unsigned stackSize, uint8_t priority, unsigned arenaSize = 0) {
+    return run_task<T, T>(task, arg, stackSize, priority, arenaSize);
+  }
+
+  template<typename T>
+  static int run_task(BTask<T&>& task, T& arg, unsigned stackSize, uint8_t priority, unsigned arenaSize = 0) {    
+    return run_task<T&, T>(task, arg, stackSize, priority, arenaSize);
+  }
+
+  template<typename... Params, typename... Args>
+  static int emplace_task(unsigned stackSize, uint8_t priority, void (*task)(Params...), Args&&... args) {
+    static_assert(sizeof...(Params) == sizeof...(Args), "pass one argument per task parameter");
+    if (!_initialized || priority > TaskPriority::Low || !stackSize) {
+      return -1;
     }
 
-    auto taskInfo = alloc_task(task, arg, stackSize);
-    if (new_task == _tasks.Length()) {
-      _tasks.Add(taskInfo);
-    } else {
-      _tasks[new_task] = taskInfo;
+    auto taskInfo = alloc_info<BEmplaceTaskInfo<Params...> >(stackSize, 0, task, BForward<Args>(args)...);
+    if (!taskInfo) {
+      return -1;
     }
+    return start_task(taskInfo, priority, (BTaskWrapper)emplace_wrapper<Params...>);
+  }
 
-    taskInfo->id = new_task;
-    taskInfo->priority(priority);
-    if (!_pri[priority].count) {
-      _pri[priority].current = new_task;
-    };
-    ++_pri[priority].count;
+  template<typename T, typename U>
+  static int run_periodic_task(BTask<T>& task, U& arg, unsigned long period, unsigned long deadline, unsigned stackSize) {
+    if (!_initialized || !period || !stackSize) {
+      return -1;
+    }
 
-    init_task(taskInfo, (BTaskWrapper)task_wrapper<typename BTask<T>::ArgumentType, U>);
-    return new_task;
+    auto taskInfo = alloc_info<BPeriodicTaskInfo<T, U> >(stackSize, 0, task, arg);
+    if (!taskInfo) {
+      return -1;
+    }
+    taskInfo->info.period = period;
+    taskInfo->info.deadline = deadline ? deadline : period;
+    taskInfo->info.release = ticks();
+    return start_task(taskInfo, TaskPriority::High, (BTaskWrapper)periodic_wrapper<T, U>);
   }
 
   template<typename T>
-  static int run_task(BTask<T>& task, T& arg, unsigned stackSize, uint8_t priority) {
-    return run_task<T, T>(task, arg, stackSize, priority);
+  static int run_periodic_task(BTask<T>& task, T& arg, unsigned long period, unsigned long deadline, unsigned stackSize) {
+    return run_periodic_task<T, T>(task, arg, period, deadline, stackSize);
   }
 
   template<typename T>
-  static int run_task(BTask<T&>& task, T& arg, unsigned stackSize, uint8_t priority) {    
-    return run_task<T&, T>(task, arg, stackSize, priority);
+  static int run_periodic_task(BTask<T&>& task, T& arg, unsigned long period, unsigned long deadline, unsigned stackSize) {
+    return run_periodic_task<T&, T>(task, arg, period, deadline, stackSize);
   }
 
   template<typename T>
-  friend int ::runTask(void (*)(T&), T&, unsigned, uint8_t);
+  friend int ::runTask(void (*)(T&), T&, unsigned, uint8_t, unsigned);
   template<typename T, typename U>
-  friend int ::runTask(const T*, void (T::*)(U&), U&, unsigned stackSize, uint8_t priority);
+  friend int ::runTask(const T*, void (T::*)(U&), U&, unsigned, uint8_t, unsigned);
   template<typename T>
-  friend int ::runTask(void (*)(T), T, unsigned, uint8_t);
+  friend int ::runTask(void (*)(T), T, unsigned, uint8_t, unsigned);
   template<typename T, typename U>
-  friend int ::runTask(const T*, void (T::*)(U), U, unsigned, uint8_t);
+  friend int ::runTask(const T*, void (T::*)(U), U, unsigned, uint8_t, unsigned);
+  template<typename... Params, typename... Args>
+  friend int ::emplaceTask(unsigned, uint8_t, void (*)(Params...), Args&&...);
+  template<typename T>
+  friend int ::runPeriodicTask(void (*)(T&), T&, unsigned long, unsigned long, unsigned);
+  template<typename T>
+  friend int ::runPeriodicTask(void (*)(T), T, unsigned long, unsigned long, unsigned);
+  friend bool ::getPeriodicStats(int, PeriodicStats&);
+  friend bool ::setTaskBudget(int, unsigned, unsigned);
+  friend bool ::getBudgetStats(int, BudgetStats&);
+#ifdef TASKFUN_LATENCY
+  friend bool ::getLatencyStats(int, LatencyStats&);
+  friend void ::resetLatencyStats(int);
+#endif
+  friend void ::setSchedulingPolicy(uint8_t);
+  friend unsigned ::getUtilization();
+  friend bool ::isOverloaded();
   
   friend void ::stopTask(int);
   friend int ::currentTask();
   friend void ::pauseTask(int);
   friend void ::resumeTask(int);
+  friend void ::resumeTaskFromISR(int);
+  friend void ::notifyTask(int);
+  friend void ::notifyFromISR(int);
+  friend void ::waitNotification();
+  friend void ::yieldFromISR();
+  friend void ::lockScheduler();
+  friend void ::unlockScheduler();
+  friend void ::sleepTask(unsigned long);
+  friend bool ::waitUntil(bool (*)(void*), void*, unsigned long);
+  friend bool ::waitUntil(bool (*)(), unsigned long);
+  friend void* ::getTaskLocal(uint8_t);
+  friend void ::setTaskLocal(uint8_t, void*);
+  friend class BTimerService;
+  friend class BTaskHeap;
   friend void ::setupTasks(int, int, uint8_t);
   friend void ::yield();
-  template<typename T>
-  friend class SyncVar;
+  friend uint8_t ::getCpuLoad();
+  template<typename T, typename Lock>
+  friend class ::SyncVar;
+  friend class ::TaskStream;
+  friend class ::ConditionVariable;
+  friend class ::TaskLogBase;
+  template<unsigned Size, uint8_t Count>
+  friend class ::BufferPool;
+  template<typename T, uint8_t Count>
+  friend class ::Channel;
+  template<typename T, uint8_t Count>
+  friend class ::Topic;
+  template<typename T, unsigned StackSize>
+  friend class ::StaticTask;
+  template<uint8_t Count>
+  friend class ::TaskTable;
 
   __BTASKSWITCHER_ARCH_CLASS__
 };
@@ -216,27 +802,56 @@ protected:
 }
 
 template<typename T>
-int runTask(void (*task)(T& arg), T& arg, unsigned stackSize, uint8_t priority) {
+int runTask(void (*task)(T& arg), T& arg, unsigned stackSize, uint8_t priority, unsigned arenaSize) {
+  // the task's delegate must not come from the caller's arena
+  Buratino::BTaskSwitcher::BGlobalHeap heap;
   auto btask = Buratino::BTask<T&>(task);
-  return Buratino::BTaskSwitcher::run_task(btask, arg, stackSize, priority);
+  return Buratino::BTaskSwitcher::run_task(btask, arg, stackSize, priority, arenaSize);
 }
 
 template<typename T, typename U>
-int runTask(const T* instance, void (T::*task)(U& arg), U& arg, unsigned stackSize, uint8_t priority) {
+int runTask(const T* instance, void (T::*task)(U& arg), U& arg, unsigned stackSize, uint8_t priority, unsigned arenaSize) {
+  // the task's delegate must not come from the caller's arena
+  Buratino::BTaskSwitcher::BGlobalHeap heap;
   auto btask = Buratino::BTask<U&>(instance, task);
-  return Buratino::BTaskSwitcher::run_task(btask, arg, stackSize, priority);
+  return Buratino::BTaskSwitcher::run_task(btask, arg, stackSize, priority, arenaSize);
 }
 
 template<typename T>
-int runTask(void (*task)(T arg), T arg, unsigned stackSize, uint8_t priority) {
+int runTask(void (*task)(T arg), T arg, unsigned stackSize, uint8_t priority, unsigned arenaSize) {
+  // the task's delegate must not come from the caller's arena
+  Buratino::BTaskSwitcher::BGlobalHeap heap;
   auto btask = Buratino::BTask<T>(task);
-  return Buratino::BTaskSwitcher::run_task(btask, arg, stackSize, priority);
+  return Buratino::BTaskSwitcher::run_task(btask, arg, stackSize, priority, arenaSize);
 }
 
 template<typename T, typename U>
-int runTask(const T* instance, void (T::*task)(U arg), U arg, unsigned stackSize, uint8_t priority) {
+int runTask(const T* instance, void (T::*task)(U arg), U arg, unsigned stackSize, uint8_t priority, unsigned arenaSize) {
+  // the task's delegate must not come from the caller's arena
+  Buratino::BTaskSwitcher::BGlobalHeap heap;
   auto btask = Buratino::BTask<T>(instance, task);
-  return Buratino::BTaskSwitcher::run_task(btask, arg, stackSize, priority);
+  return Buratino::BTaskSwitcher::run_task(btask, arg, stackSize, priority, arenaSize);
+}
+
+template<typename... Params, typename... Args>
+int emplaceTask(unsigned stackSize, uint8_t priority, void (*task)(Params...), Args&&... args) {
+  // the arguments must not come from the caller's arena
+  Buratino::BTaskSwitcher::BGlobalHeap heap;
+  return Buratino::BTaskSwitcher::emplace_task(stackSize, priority, task, Buratino::BForward<Args>(args)...);
+}
+
+template<typename T>
+int runPeriodicTask(void (*task)(T& arg), T& arg, unsigned long periodMs, unsigned long deadlineMs, unsigned stackSize) {
+  Buratino::BTaskSwitcher::BGlobalHeap heap;
+  auto btask = Buratino::BTask<T&>(task);
+  return Buratino::BTaskSwitcher::run_periodic_task(btask, arg, periodMs, deadlineMs, stackSize);
+}
+
+template<typename T>
+int runPeriodicTask(void (*task)(T arg), T arg, unsigned long periodMs, unsigned long deadlineMs, unsigned stackSize) {
+  Buratino::BTaskSwitcher::BGlobalHeap heap;
+  auto btask = Buratino::BTask<T>(task);
+  return Buratino::BTaskSwitcher::run_periodic_task(btask, arg, periodMs, deadlineMs, stackSize);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,144 @@
+// Cortex-M3/M4 (SAMD51), Cortex-M0+ is in BTaskSwitcherSAMD.cpp
+#if defined(ARDUINO_ARCH_SAMD) && (defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__))
+#include <Arduino.h>
+#include "BTaskSwitcher.h"
+
+namespace Buratino {
+
+// initial context of a task, a task that used the FPU also has s16-s31 below
+// r4 and s0-s15 in the exception frame
+struct Ctx {
+  uint32_t r4;
+  uint32_t r5;
+  uint32_t r6;
+  uint32_t r7;
+  uint32_t r8;
+  uint32_t r9;
+  uint32_t r10;
+  uint32_t r11;
+  uint32_t exc_return;
+  uint32_t r0;
+  uint32_t r1;
+  uint32_t r2;
+  uint32_t r3;
+  uint32_t r12;
+  uint32_t lr;
+  uint32_t pc;
+  uint32_t psr;
+};
+
+// s16-s31, s0-s15, fpscr and padding of the extended frame
+#ifdef __BTASKSWITCHER_FPU__
+static_assert(sizeof(Ctx) + 34 * sizeof(uint32_t) == __BTASKSWITCHER_CONTEXT_SIZE__, "context size");
+#else
+static_assert(sizeof(Ctx) == __BTASKSWITCHER_CONTEXT_SIZE__, "context size");
+#endif
+
+unsigned BTaskSwitcher::context_size() {
+  return __BTASKSWITCHER_CONTEXT_SIZE__;
+}
+
+bool BTaskSwitcher::disable() {
+  auto enabled = __get_PRIMASK() == 0;
+  noInterrupts();
+  return enabled;
+}
+
+void BTaskSwitcher::init_task(BTaskInfoBase* taskInfo, BTaskWrapper wrapper) {
+  // 8 bytes align per ARM Cortex+ requirement when entering interrupt
+  taskInfo->sp = (uint8_t*)((uintptr_t)taskInfo->sp & ~0x7);
+
+  // clear registers
+  for (unsigned i = 0; i < sizeof(Ctx); ++i) {
+    *--taskInfo->sp = 0;
+  }
+
+  auto ctx = (Ctx*)taskInfo->sp;
+  // compiler/architecture specific, passing argument via registers
+  ctx->r0 = (uintptr_t)taskInfo;
+  ctx->psr = 0x01000000;
+  ctx->pc = (uintptr_t)wrapper;
+  // return to thread mode on the main stack with a basic frame, the task has
+  // no FPU state until it uses the FPU
+  ctx->exc_return = 0xFFFFFFF9;
+}
+
+void BTaskSwitcher::switch_context() {
+  // trigger PendSV
+  SCB->ICSR |= SCB_ICSR_PENDSVSET_Msk;
+}
+
+void BTaskSwitcher::defer_switch() {
+  // PendSV has the lowest priority and tail-chains after the interrupt returns
+  schedule_task();
+}
+
+#ifdef TASKFUN_PROFILE_CLI
+unsigned long BTaskSwitcher::cycle_count() {
+  return DWT->CYCCNT;
+}
+
+unsigned long BTaskSwitcher::cycles_since(unsigned long start) {
+  return (uint32_t)(DWT->CYCCNT - start);
+}
+#endif
+
+void BTaskSwitcher::init_arch() {
+  // set systick and pendsv to same priority
+  uint32_t systick_priority = NVIC_GetPriority(SysTick_IRQn);
+  NVIC_SetPriority(PendSV_IRQn, systick_priority);
+
+#ifdef __BTASKSWITCHER_FPU__
+  // automatic and lazy stacking of s0-s15, the hardware only saves them when
+  // the interrupted code used the FPU and the handler uses it too
+  FPU->FPCCR |= FPU_FPCCR_ASPEN_Msk | FPU_FPCCR_LSPEN_Msk;
+#endif
+
+#ifdef TASKFUN_PROFILE_CLI
+  // the cycle counter of the debug unit
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+}
+
+}
+
+using namespace Buratino;
+
+extern "C" {
+
+  void __attribute__((naked)) PendSV_Handler() {
+    asm volatile(
+      "cpsid i\n"
+#ifdef __BTASKSWITCHER_FPU__
+      // bit 4 of EXC_RETURN is clear if the task used the FPU
+      "tst lr, #0x10\n"
+      "it eq\n"
+      "vstmdbeq sp!, {s16-s31}\n"
+#endif
+      "stmdb sp!, {r4-r11, lr}\n"
+      "mov r0, sp\n"
+      "blx %0\n"
+      "mov sp, r0\n"
+      "ldmia sp!, {r4-r11, lr}\n"
+#ifdef __BTASKSWITCHER_FPU__
+      "tst lr, #0x10\n"
+      "it eq\n"
+      "vldmiaeq sp!, {s16-s31}\n"
+#endif
+      "cpsie i\n"
+      "bx lr\n"
+      :
+      : "r"(BTaskSwitcher::swap_stack)
+      : "r0");
+  }
+
+#ifndef TASKFUN_COOPERATIVE
+  int sysTickHook() {
+    BTaskSwitcher::preempt_task();
+    return 0;
+  }
+#endif
+}
+
+#endif
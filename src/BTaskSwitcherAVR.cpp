@@ -41,6 +41,8 @@ struct Ctx {
   uint8_t r0;
 };
 
+static_assert(sizeof(Ctx) == __BTASKSWITCHER_CONTEXT_SIZE__, "context size");
+
 unsigned BTaskSwitcher::context_size() {
   return sizeof(Ctx);
 }
@@ -136,6 +138,11 @@ void BTaskSwitcher::switch_context() {
   avr_switch_context();
 }
 
+void BTaskSwitcher::defer_switch() {
+  // no pendable interrupt on AVR, the switch happens in yieldFromISR() at the
+  // end of the interrupt handler or on the next tick
+}
+
 void BTaskSwitcher::init_task(BTaskInfoBase* taskInfo, BTaskWrapper wrapper) {
   // push task_wrapper address for `ret` to pop
   *taskInfo->sp-- = lowByte((uintptr_t)wrapper);
@@ -156,28 +163,45 @@ void BTaskSwitcher::init_task(BTaskInfoBase* taskInfo, BTaskWrapper wrapper) {
   ctx->r25 = highByte((uintptr_t)taskInfo);  // r25
 }
 
+#ifdef TASKFUN_PROFILE_CLI
+unsigned long BTaskSwitcher::cycle_count() {
+  return TCNT1;
+}
+
+// 16 bits, sections longer than 65535 cycles wrap
+unsigned long BTaskSwitcher::cycles_since(unsigned long start) {
+  return (uint16_t)(TCNT1 - start);
+}
+#endif
+
 void BTaskSwitcher::init_arch() {
-  BDisableInterrupts cli;
+#ifdef TASKFUN_PROFILE_CLI
+  // Timer1 without prescaler counts CPU cycles, its PWM pins can't be used
+  TCCR1A = 0;
+  TCCR1B = _BV(CS10);
+#endif
 
-  // Clear the Timer on Compare Match (CTC) mode (setting the WGM01 bit).
-  TCCR0A |= (1 << WGM01);
+#ifndef TASKFUN_COOPERATIVE
+  BDisableInterrupts cli;
 
-  // Set the Output Compare Register A value for a 1 ms interrupt rate.
+  // Timer0 stays in the fast PWM mode Arduino sets up for millis(), so the
+  // compare match fires once per overflow, every 1.024ms. The tick catches up
+  // with millis() and times are still counted in milliseconds.
   OCR0A = 249;
 
   // Enable the Timer0 Compare Match A interrupt.
   TIMSK0 |= (1 << OCIE0A);
-
-  // The prescaler is already set by Arduino's initialization code to 64.
-  // Hence no need to set it again.
+#endif
 }
 
 }
 
 using namespace Buratino;
 
+#ifndef TASKFUN_COOPERATIVE
 ISR(TIMER0_COMPA_vect) {
   BTaskSwitcher::preempt_task();
 }
+#endif
 
 #endif
\ No newline at end of file
@@ -1,5 +1,8 @@
 #ifdef ARDUINO_ARCH_AVR
 
+// bytes of a task's initial context, used to size static task stacks
+#define __BTASKSWITCHER_CONTEXT_SIZE__ 33
+
 #define __BTASKSWITCHER_ARCH_HEADER__ \
   extern "C" void TIMER0_COMPA_vect();
 
@@ -1,4 +1,5 @@
-#ifdef ARDUINO_ARCH_SAMD
+// Cortex-M0+ (SAMD21), ARMv7-M cores are in BTaskSwitcherARMv7M.cpp
+#if defined(ARDUINO_ARCH_SAMD) && !defined(__ARM_ARCH_7M__) && !defined(__ARM_ARCH_7EM__)
 #include <Arduino.h>
 #include "BTaskSwitcher.h"
 
@@ -23,6 +24,8 @@ struct Ctx {
   uint32_t psr;
 };
 
+static_assert(sizeof(Ctx) == __BTASKSWITCHER_CONTEXT_SIZE__, "context size");
+
 unsigned BTaskSwitcher::context_size() {
   return sizeof(Ctx);
 }
@@ -54,6 +57,23 @@ void BTaskSwitcher::switch_context() {
   SCB->ICSR |= SCB_ICSR_PENDSVSET_Msk;
 }
 
+void BTaskSwitcher::defer_switch() {
+  // PendSV has the lowest priority and tail-chains after the interrupt returns
+  schedule_task();
+}
+
+#ifdef TASKFUN_PROFILE_CLI
+// SysTick counts CPU cycles down and is reloaded every 1ms by the core
+unsigned long BTaskSwitcher::cycle_count() {
+  return SysTick->VAL;
+}
+
+unsigned long BTaskSwitcher::cycles_since(unsigned long start) {
+  unsigned long now = SysTick->VAL;
+  return start >= now ? start - now : start + SysTick->LOAD + 1 - now;
+}
+#endif
+
 void BTaskSwitcher::init_arch() {
   // set systick and pendsv to same priority
   uint32_t systick_priority = NVIC_GetPriority(SysTick_IRQn);
@@ -98,10 +118,12 @@ extern "C" {
     asm volatile("bx lr");
   }
 
+#ifndef TASKFUN_COOPERATIVE
   int sysTickHook() {
     BTaskSwitcher::preempt_task();
     return 0;
   }
+#endif
 }
 
 #endif
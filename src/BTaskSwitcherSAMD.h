@@ -1,5 +1,18 @@
 #ifdef ARDUINO_ARCH_SAMD
 
+// bytes of a task's initial context, used to size static task stacks
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+// the FPU registers are only saved if the code is built for the FPU
+#if defined(__VFP_FP__) && !defined(__SOFTFP__)
+#define __BTASKSWITCHER_FPU__
+#define __BTASKSWITCHER_CONTEXT_SIZE__ 204
+#else
+#define __BTASKSWITCHER_CONTEXT_SIZE__ 68
+#endif
+#else
+#define __BTASKSWITCHER_CONTEXT_SIZE__ 64
+#endif
+
 #define __BTASKSWITCHER_ARCH_HEADER__ \
   extern "C" int sysTickHook();
 
@@ -0,0 +1,216 @@
+#include <Arduino.h>
+#include "BList.h"
+#include "BTaskSwitcher.h"
+#include "BTimerService.h"
+
+namespace Buratino {
+
+BList<BTimerService::BTimer*> BTimerService::_timers;
+BList<int> BTimerService::_free;
+BList<BTimerService::BTimer*> BTimerService::_heap;
+int BTimerService::_service = -1;
+
+bool BTimerService::before(BTimer* a, BTimer* b) {
+  return (long)(a->deadline - b->deadline) < 0;
+}
+
+void BTimerService::place(BTimer* timer, unsigned index) {
+  _heap[index] = timer;
+  timer->index = index;
+}
+
+void BTimerService::sift_up(unsigned index) {
+  auto timer = _heap[index];
+  while (index > 0) {
+    auto parent = (index - 1) / 2;
+    if (!before(timer, _heap[parent])) {
+      break;
+    }
+    place(_heap[parent], index);
+    index = parent;
+  }
+  place(timer, index);
+}
+
+void BTimerService::sift_down(unsigned index) {
+  auto timer = _heap[index];
+  auto count = _heap.Length();
+  while (1) {
+    auto child = index * 2 + 1;
+    if (child >= count) {
+      break;
+    }
+    if (child + 1 < count && before(_heap[child + 1], _heap[child])) {
+      ++child;
+    }
+    if (!before(_heap[child], timer)) {
+      break;
+    }
+    place(_heap[child], index);
+    index = child;
+  }
+  place(timer, index);
+}
+
+void BTimerService::push(BTimer* timer) {
+  _heap.Add(timer);
+  sift_up(_heap.Length() - 1);
+}
+
+void BTimerService::remove(unsigned index) {
+  auto last = _heap.Length() - 1;
+  auto timer = _heap[last];
+  _heap.Remove(last);
+  if (index != last) {
+    place(timer, index);
+    sift_up(index);
+    sift_down(timer->index);
+  }
+}
+
+// call with interrupts disabled, the next timer in this slot gets the next
+// generation id so a stale id can't stop it
+void BTimerService::release_slot(BTimer* timer) {
+  auto slot = timer->id & SlotMask;
+  auto generation = ((timer->id >> SlotBits) + 1) & GenerationMask;
+  _free.Add((generation << SlotBits) | slot);
+  _timers[slot] = 0;
+}
+
+// the lists grow together with interrupts enabled, the free list and the heap
+// are never smaller than the timer list so they don't grow under cli
+void BTimerService::reserve(unsigned capacity) {
+  BTaskSwitcher::grow(_free, capacity);
+  BTaskSwitcher::grow(_heap, capacity);
+  BTaskSwitcher::grow(_timers, capacity);
+}
+
+void BTimerService::service(int) {
+  while (1) {
+    auto cli = BTaskSwitcher::disable();
+    if (!_heap.Length()) {
+      // nothing to do until create_timer() resumes the service
+      BTaskSwitcher::pause_task(_service);
+      BTaskSwitcher::restore(cli);
+      continue;
+    }
+
+    auto timer = _heap[0];
+    if ((long)(BTaskSwitcher::ticks() - timer->deadline) < 0) {
+      BTaskSwitcher::sleep_until(timer->deadline);
+      BTaskSwitcher::restore(cli);
+      continue;
+    }
+
+    auto callback = timer->callback;
+    auto arg = timer->arg;
+    if (timer->period) {
+      // advance from the previous deadline to avoid drift
+      timer->deadline += timer->period;
+      sift_down(0);
+      timer = 0;
+    } else {
+      remove(0);
+      release_slot(timer);
+    }
+    BTaskSwitcher::restore(cli);
+
+    delete timer;
+    callback(arg);
+  }
+}
+
+bool BTimerService::initialize(int timers, unsigned stackSize, uint8_t priority) {
+  // setupTimers() may be called from a task with an arena, the lock keeps
+  // other tasks from starting a second service
+  BTaskSwitcher::BGlobalHeap heap;
+  SchedulerLock lock;
+  if (_service < 0 && timers > 0) {
+    reserve((unsigned)timers < MaxTimers ? timers : MaxTimers);
+    _service = runTask(service, 0, stackSize, priority);
+  }
+  return _service >= 0;
+}
+
+int BTimerService::create_timer(unsigned long period, void (*callback)(void*), void* arg, bool oneShot) {
+  // the service task frees the timers and owns the lists, neither can come
+  // from the caller's arena
+  BTaskSwitcher::BGlobalHeap heap;
+  if (!callback || (!period && !oneShot) || !initialize(4, 256 * sizeof(int), TaskPriority::High)) {
+    return -1;
+  }
+
+  auto timer = new BTimer();
+  if (!timer) {
+    return -1;
+  }
+  timer->period = oneShot ? 0 : period;
+  timer->callback = callback;
+  timer->arg = arg;
+
+  while (1) {
+    unsigned capacity;
+    {
+      BDisableInterrupts cli;
+      if (_free.Length() || _timers.Length() < _timers.Capacity()) {
+        int id;
+        if (_free.Length()) {
+          id = _free[_free.Length() - 1];
+          _free.Remove(_free.Length() - 1);
+        } else {
+          id = _timers.Length();
+          _timers.Add(0);
+        }
+
+        _timers[id & SlotMask] = timer;
+        timer->id = id;
+        timer->deadline = BTaskSwitcher::ticks() + period;
+        push(timer);
+
+        // wake up the service if the new timer is the earliest
+        if (timer->index == 0) {
+          BTaskSwitcher::resume_task(_service);
+        }
+        return id;
+      }
+      if (_timers.Length() >= MaxTimers) {
+        break;
+      }
+      capacity = _timers.Capacity() * 2;
+    }
+    reserve(capacity < MaxTimers ? capacity : MaxTimers);
+  }
+
+  delete timer;
+  return -1;
+}
+
+void BTimerService::stop_timer(int id) {
+  BTimer* timer = 0;
+  {
+    BDisableInterrupts cli;
+    auto slot = (unsigned)(id & SlotMask);
+    if (id >= 0 && slot < _timers.Length() && _timers[slot] && _timers[slot]->id == id) {
+      timer = _timers[slot];
+      release_slot(timer);
+      remove(timer->index);
+    }
+  }
+  delete timer;
+}
+
+}
+
+using namespace Buratino;
+
+int createTimer(unsigned long periodMs, void (*callback)(void*), void* arg, bool oneShot) {
+  return BTimerService::create_timer(periodMs, callback, arg, oneShot);
+}
+
+void stopTimer(int id) {
+  BTimerService::stop_timer(id);
+}
+
+void setupTimers(int numTimers, unsigned stackSize, uint8_t priority) {
+  BTimerService::initialize(numTimers, stackSize, priority);
+}
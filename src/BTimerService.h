@@ -0,0 +1,61 @@
+#ifndef __BTIMERSERVICE_H__
+#define __BTIMERSERVICE_H__
+
+#include "BTaskSwitcher.h"
+
+int createTimer(unsigned long periodMs, void (*callback)(void*), void* arg = 0, bool oneShot = false);
+void stopTimer(int id);
+void setupTimers(int numTimers = 4, unsigned stackSize = 256 * sizeof(int), uint8_t priority = TaskPriority::High);
+
+namespace Buratino {
+
+/*
+  BTimerService - software timers run from a single task
+*/
+class BTimerService {
+protected:
+  typedef BTaskSwitcher::BDisableInterrupts BDisableInterrupts;
+
+  // timer id is the slot in the timer list plus a generation count of the slot
+  static const int SlotBits = 8;
+  static const int SlotMask = (1 << SlotBits) - 1;
+  static const int GenerationMask = 0x7F;
+  static const unsigned MaxTimers = 1 << SlotBits;
+
+  struct BTimer {
+    unsigned long deadline;
+    unsigned long period;  // 0 for one-shot timers
+    void (*callback)(void*);
+    void* arg;
+    int id;
+    unsigned index;  // position in the heap
+  };
+
+protected:
+  static BList<BTimer*> _timers;  // indexed by timer slot
+  static BList<int> _free;        // ids for the free slots
+  static BList<BTimer*> _heap;    // min-heap ordered by deadline
+  static int _service;
+
+protected:
+  static bool before(BTimer* a, BTimer* b);
+  static void place(BTimer* timer, unsigned index);
+  static void sift_up(unsigned index);
+  static void sift_down(unsigned index);
+  static void push(BTimer* timer);
+  static void remove(unsigned index);
+  static void release_slot(BTimer* timer);
+  static void reserve(unsigned capacity);
+  static void service(int);
+  static bool initialize(int timers, unsigned stackSize, uint8_t priority);
+  static int create_timer(unsigned long period, void (*callback)(void*), void* arg, bool oneShot);
+  static void stop_timer(int id);
+
+  friend int ::createTimer(unsigned long, void (*)(void*), void*, bool);
+  friend void ::stopTimer(int);
+  friend void ::setupTimers(int, unsigned, uint8_t);
+};
+
+}
+
+#endif
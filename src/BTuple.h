@@ -0,0 +1,103 @@
+#ifndef __BTUPLE_H__
+#define __BTUPLE_H__
+
+namespace Buratino {
+/*
+  BTuple - a minimal tuple with forwarding helpers, AVR has no <utility>
+*/
+template<typename T>
+struct BRemoveReference {
+  typedef T Type;
+};
+
+template<typename T>
+struct BRemoveReference<T&> {
+  typedef T Type;
+};
+
+template<typename T>
+struct BRemoveReference<T&&> {
+  typedef T Type;
+};
+
+// the type an argument is stored as, without reference and const
+template<typename T>
+struct BDecay {
+  typedef typename BRemoveReference<T>::Type Type;
+};
+
+template<typename T>
+struct BDecay<const T> {
+  typedef T Type;
+};
+
+template<typename T>
+struct BDecay<const T&> {
+  typedef T Type;
+};
+
+template<typename T>
+T&& BForward(typename BRemoveReference<T>::Type& value) {
+  return static_cast<T&&>(value);
+}
+
+template<typename T>
+T&& BForward(typename BRemoveReference<T>::Type&& value) {
+  return static_cast<T&&>(value);
+}
+
+template<typename T>
+typename BRemoveReference<T>::Type&& BMove(T&& value) {
+  return static_cast<typename BRemoveReference<T>::Type&&>(value);
+}
+
+template<unsigned... I>
+struct BIndices {};
+
+// BMakeIndices<3>::Type is BIndices<0, 1, 2>
+template<unsigned N, unsigned... I>
+struct BMakeIndices : BMakeIndices<N - 1, N - 1, I...> {};
+
+template<unsigned... I>
+struct BMakeIndices<0, I...> {
+  typedef BIndices<I...> Type;
+};
+
+template<typename... T>
+struct BTuple;
+
+template<>
+struct BTuple<> {
+  BTuple() {}
+};
+
+// each element is constructed in place from the forwarded argument
+template<typename T, typename... Rest>
+struct BTuple<T, Rest...> : BTuple<Rest...> {
+  T value;
+
+  template<typename U, typename... Us>
+  BTuple(U&& first, Us&&... rest)
+    : BTuple<Rest...>(BForward<Us>(rest)...), value(BForward<U>(first)) {}
+};
+
+template<unsigned I, typename T, typename... Rest>
+struct BTupleElement {
+  typedef typename BTupleElement<I - 1, Rest...>::Type Type;
+
+  static Type& get(BTuple<T, Rest...>& tuple) {
+    return BTupleElement<I - 1, Rest...>::get(tuple);
+  }
+};
+
+template<typename T, typename... Rest>
+struct BTupleElement<0, T, Rest...> {
+  typedef T Type;
+
+  static T& get(BTuple<T, Rest...>& tuple) {
+    return tuple.value;
+  }
+};
+
+}
+#endif
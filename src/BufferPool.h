@@ -0,0 +1,75 @@
+#ifndef __BUFFERPOOL_H__
+#define __BUFFERPOOL_H__
+
+#include "BTaskSwitcher.h"
+
+/*
+  BufferPool - fixed number of fixed size buffers, acquire() suspends the
+  calling task while all buffers are in use
+*/
+template<unsigned Size, uint8_t Count>
+class BufferPool {
+protected:
+  typedef Buratino::BTaskSwitcher BTaskSwitcher;
+  typedef BTaskSwitcher::BDisableInterrupts Cli;
+
+protected:
+  uint8_t _buffers[Count][Size];
+  uint8_t _free[Count];  // stack of free buffer indices
+  uint8_t _used[(Count + 7) / 8];  // bit per buffer, set while acquired
+  volatile uint8_t _available;
+
+protected:
+  static bool has_buffer(void* pool) {
+    return ((BufferPool*)pool)->_available;
+  }
+
+public:
+  BufferPool()
+    : _used(), _available(Count) {
+    for (uint8_t i = 0; i < Count; ++i) {
+      _free[i] = i;
+    }
+  }
+
+  // returns null if no buffer became available within the timeout
+  uint8_t* acquire(unsigned long timeoutMs = TaskTimeout::Forever) {
+    Cli cli;
+    if (!BTaskSwitcher::wait_until(has_buffer, this, timeoutMs)) {
+      return 0;
+    }
+    auto index = _free[--_available];
+    _used[index / 8] |= 1 << (index % 8);
+    return _buffers[index];
+  }
+
+  // returns false for a pointer that isn't a buffer of this pool or a buffer
+  // that is already free
+  bool release(uint8_t* buffer) {
+    auto offset = (uintptr_t)buffer - (uintptr_t)_buffers;
+    if (offset >= sizeof(_buffers) || offset % Size) {
+      return false;
+    }
+
+    uint8_t index = offset / Size;
+    uint8_t bit = 1 << (index % 8);
+    Cli cli;
+    if (!(_used[index / 8] & bit)) {
+      return false;
+    }
+    _used[index / 8] &= ~bit;
+    _free[_available++] = index;
+    BTaskSwitcher::wake_ready_tasks();
+    return true;
+  }
+
+  uint8_t available() {
+    return _available;
+  }
+
+  unsigned size() {
+    return Size;
+  }
+};
+
+#endif
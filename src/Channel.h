@@ -0,0 +1,72 @@
+#ifndef __CHANNEL_H__
+#define __CHANNEL_H__
+
+#include "BTaskSwitcher.h"
+
+/*
+  Channel - fixed size queue between tasks, send() suspends the calling task
+  while the channel is full and receive() while it's empty. Items are copied
+  with interrupts disabled, pass pointers to BufferPool buffers for anything
+  larger than a few bytes.
+*/
+template<typename T, uint8_t Count>
+class Channel {
+protected:
+  typedef Buratino::BTaskSwitcher BTaskSwitcher;
+  typedef BTaskSwitcher::BDisableInterrupts Cli;
+
+protected:
+  T _items[Count];
+  uint8_t _head;
+  volatile uint8_t _length;
+
+protected:
+  static bool can_send(void* channel) {
+    return ((Channel*)channel)->_length < Count;
+  }
+
+  static bool can_receive(void* channel) {
+    return ((Channel*)channel)->_length;
+  }
+
+public:
+  Channel()
+    : _head(0), _length(0) {}
+
+  // returns false if the channel stayed full for the whole timeout
+  bool send(const T& item, unsigned long timeoutMs = TaskTimeout::Forever) {
+    Cli cli;
+    if (!BTaskSwitcher::wait_until(can_send, this, timeoutMs)) {
+      return false;
+    }
+    uint8_t tail = _head + _length;
+    if (tail >= Count) {
+      tail -= Count;
+    }
+    _items[tail] = item;
+    ++_length;
+    BTaskSwitcher::wake_ready_tasks();
+    return true;
+  }
+
+  // returns false if the channel stayed empty for the whole timeout
+  bool receive(T& item, unsigned long timeoutMs = TaskTimeout::Forever) {
+    Cli cli;
+    if (!BTaskSwitcher::wait_until(can_receive, this, timeoutMs)) {
+      return false;
+    }
+    item = _items[_head];
+    if (++_head == Count) {
+      _head = 0;
+    }
+    --_length;
+    BTaskSwitcher::wake_ready_tasks();
+    return true;
+  }
+
+  uint8_t length() {
+    return _length;
+  }
+};
+
+#endif
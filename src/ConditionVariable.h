@@ -0,0 +1,35 @@
+#ifndef __CONDITIONVARIABLE_H__
+#define __CONDITIONVARIABLE_H__
+
+#include "BTaskSwitcher.h"
+
+/*
+  ConditionVariable - suspends tasks until another task or an interrupt
+  handler notifies them. Check the condition and call wait() with interrupts
+  disabled so a notification between the check and wait() is not lost.
+*/
+class ConditionVariable {
+protected:
+  typedef Buratino::BTaskSwitcher BTaskSwitcher;
+  typedef BTaskSwitcher::BDisableInterrupts Cli;
+
+public:
+  // returns false if not notified within the timeout, interrupts are disabled
+  // again when wait() returns if they were disabled when it was called
+  bool wait(unsigned long timeoutMs = TaskTimeout::Forever) {
+    return BTaskSwitcher::wait_until(0, this, timeoutMs);
+  }
+
+  // resumes the highest priority waiting task
+  void notifyOne() {
+    Cli cli;
+    BTaskSwitcher::signal(this, false);
+  }
+
+  void notifyAll() {
+    Cli cli;
+    BTaskSwitcher::signal(this, true);
+  }
+};
+
+#endif
@@ -1,299 +1,416 @@
 #ifndef __SyncVar_H__
 #define __SyncVar_H__
 
+#include <string.h>
 #include "BTaskSwitcher.h"
 
-template<typename T>
+namespace Buratino {
+
+template<int>
+struct BTag {};
+
+#ifdef TASKFUN_PROFILE_CLI
+// where a SyncVar<> is declared, the default arguments take the location of
+// the outermost call
+struct BSite {
+  const char* file;
+  int line;
+
+  explicit BSite(const char* file = __builtin_FILE(), int line = __builtin_LINE())
+    : file(file), line(line) {}
+};
+#endif
+
+// SyncVar<> lock policies, BTaskLock protects from other tasks and BIsrLock
+// also from interrupt handlers. Cooperative tasks can't interrupt each other.
+struct BTaskLock {
+#ifdef TASKFUN_COOPERATIVE
+  static const bool needed = false;
+#else
+  static const bool needed = true;
+#endif
+};
+
+struct BIsrLock {
+  static const bool needed = true;
+};
+
+// SyncVar<> updates 1, 2 and 4 byte values with exclusive load/store instead of
+// disabling interrupts where the core supports it
+template<unsigned Size>
+struct BExclusive {
+  static const bool supported = false;
+};
+
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__)
+inline uint8_t load_exclusive(volatile uint8_t* p) {
+  return __LDREXB(p);
+}
+
+inline uint16_t load_exclusive(volatile uint16_t* p) {
+  return __LDREXH(p);
+}
+
+inline uint32_t load_exclusive(volatile uint32_t* p) {
+  return __LDREXW(p);
+}
+
+inline bool store_exclusive(volatile uint8_t* p, uint8_t value) {
+  return !__STREXB(value, p);
+}
+
+inline bool store_exclusive(volatile uint16_t* p, uint16_t value) {
+  return !__STREXH(value, p);
+}
+
+inline bool store_exclusive(volatile uint32_t* p, uint32_t value) {
+  return !__STREXW(value, p);
+}
+
+template<typename U>
+struct BExclusiveWord {
+  static const bool supported = true;
+
+  // aligned loads up to 4 bytes are atomic
+  template<typename T>
+  static T load(const T& value) {
+    U bits = *(const volatile U*)&value;
+    T result;
+    memcpy(&result, &bits, sizeof(T));
+    return result;
+  }
+
+  // retry until no interrupt or context switch happened between load and store
+  template<typename T, typename F>
+  static T update(T& value, F op) {
+    T old;
+    T result;
+    U bits;
+    do {
+      bits = load_exclusive((volatile U*)&value);
+      memcpy(&old, &bits, sizeof(T));
+      result = old;
+      op(result);
+      memcpy(&bits, &result, sizeof(T));
+    } while (!store_exclusive((volatile U*)&value, bits));
+    return old;
+  }
+};
+
+template<>
+struct BExclusive<1> : BExclusiveWord<uint8_t> {};
+
+template<>
+struct BExclusive<2> : BExclusiveWord<uint16_t> {};
+
+template<>
+struct BExclusive<4> : BExclusiveWord<uint32_t> {};
+#endif
+
+}
+
+template<typename T, typename Lock = Buratino::BTaskLock>
 class SyncVar {
 protected:
   typedef Buratino::BTaskSwitcher::BDisableInterrupts Cli;
+  // exclusive load/store needs the value aligned to its size, packed structs
+  // fall back to disabling interrupts
+  typedef Buratino::BExclusive<(alignof(T) >= sizeof(T)) ? sizeof(T) : 0> Exclusive;
+
+  // 0 - no lock, 1 - disable interrupts, 2 - exclusive load/store
+  typedef Buratino::BTag<!Lock::needed ? 0 : Exclusive::supported ? 2 : 1> Mode;
 
 protected:
   T _value;
+#ifdef TASKFUN_PROFILE_CLI
+  // operators can't take their call site as a default argument, critical
+  // sections are reported at the line the variable is declared on
+  Buratino::BSite _site;
+#endif
+
+protected:
+  T load(Buratino::BTag<0>) const {
+    return _value;
+  }
+
+  T load(Buratino::BTag<1>) const {
+#ifdef TASKFUN_PROFILE_CLI
+    Cli cli(_site.file, _site.line);
+#else
+    Cli cli;
+#endif
+    T value = _value;
+    return value;
+  }
+
+  T load(Buratino::BTag<2>) const {
+    return Exclusive::load(_value);
+  }
+
+  template<typename F>
+  T update(F op, Buratino::BTag<0>) {
+    T old = _value;
+    op(_value);
+    return old;
+  }
+
+  template<typename F>
+  T update(F op, Buratino::BTag<1>) {
+#ifdef TASKFUN_PROFILE_CLI
+    Cli cli(_site.file, _site.line);
+#else
+    Cli cli;
+#endif
+    T old = _value;
+    op(_value);
+    return old;
+  }
+
+  template<typename F>
+  T update(F op, Buratino::BTag<2>) {
+    return Exclusive::update(_value, op);
+  }
+
+  // read the value as one uninterrupted operation
+  T load() const {
+    return load(Mode());
+  }
+
+  // apply op to the value as one uninterrupted operation, returns the old value
+  template<typename F>
+  T update(F op) {
+    return update(op, Mode());
+  }
+
 
 public:
+#ifdef TASKFUN_PROFILE_CLI
+  SyncVar(Buratino::BSite site = Buratino::BSite())
+    : _site(site) {}
+
+  SyncVar(const T& value, Buratino::BSite site = Buratino::BSite())
+    : _value(value), _site(site) {}
+#else
   SyncVar() {}
 
   SyncVar(const T& value)
     : _value(value) {}
+#endif
 
   bool compareAndSet(const T& expected_value, const T& new_value) {
-    Cli cli;  // disable interrupts
-    if (_value == expected_value) {
-        _value = new_value;
-        return true;  // success, value was changed
-    }
-    return false;  // failure, value was not changed
+    bool result = false;
+    update([&](T& value) {
+      // exclusive updates may run this more than once
+      result = false;
+      if (value == expected_value) {
+        value = new_value;
+        result = true;  // success, value was changed
+      }
+    });
+    return result;  // failure, value was not changed
   }
   
   // Overloading += operator
   SyncVar& operator+=(const T& rhs) {
-    Cli cli;
-    _value += rhs;
+    update([&](T& value) { value += rhs; });
     return *this;
   }
 
   // Overloading -= operator
   SyncVar& operator-=(const T& rhs) {
-    Cli cli;
-    _value -= rhs;
+    update([&](T& value) { value -= rhs; });
     return *this;
   }
 
   // Overloading *= operator
   SyncVar& operator*=(const T& rhs) {
-    Cli cli;
-    _value *= rhs;
+    update([&](T& value) { value *= rhs; });
     return *this;
   }
 
   // Overloading /= operator
   SyncVar& operator/=(const T& rhs) {
-    Cli cli;
-    _value /= rhs;
+    update([&](T& value) { value /= rhs; });
     return *this;
   }
 
   SyncVar& operator=(const SyncVar& rhs) {
-    Cli cli;
     if (this != &rhs) {
-      _value = rhs._value;
+      T rhs_value = rhs.load();
+      update([&](T& value) { value = rhs_value; });
     }
     return *this;
   }
 
   SyncVar& operator=(const T& rhs) {
-    Cli cli;
-    _value = rhs;
+    update([&](T& value) { value = rhs; });
     return *this;
   }
 
   // Overloading cast to T
   operator T() const {
-    Cli cli;
-    T temp = _value;
-    return temp;
+    return load();
   }
 
   // Overloading == operator for T
   bool operator==(const T& rhs) const {
-    Cli cli;
-    bool result = (_value == rhs);
-    return result;
+    return load() == rhs;
   }
 
   // Overloading != operator for T
   bool operator!=(const T& rhs) const {
-    Cli cli;
-    bool result = (_value != rhs);
-    return result;
+    return load() != rhs;
   }
 
   // Overloading < operator for T
   bool operator<(const T& rhs) const {
-    Cli cli;
-    bool result = (_value < rhs);
-    return result;
+    return load() < rhs;
   }
 
   // Overloading > operator for T
   bool operator>(const T& rhs) const {
-    Cli cli;
-    bool result = (_value > rhs);
-    return result;
+    return load() > rhs;
   }
 
   // Overloading >= operator for T
   bool operator>=(const T& rhs) const {
-    Cli cli;
-    bool result = (_value >= rhs);
-    return result;
+    return load() >= rhs;
   }
 
   // Overloading <= operator for T
   bool operator<=(const T& rhs) const {
-    Cli cli;
-    bool result = (_value <= rhs);
-    return result;
+    return load() <= rhs;
   }
 
   T operator-() const {
-    Cli cli;
-    T result = -_value;
-    return result;
+    return -load();
   }
 
   // Logical negation
   bool operator!() const {
-    Cli cli;
-    bool result = !_value;
-    return result;
+    return !load();
   }
 
   // Increment (prefix)
   SyncVar& operator++() {
-    Cli cli;
-    ++_value;
+    update([](T& value) { ++value; });
     return *this;
   }
 
   // Decrement (prefix)
   SyncVar& operator--() {
-    Cli cli;
-    --_value;
+    update([](T& value) { --value; });
     return *this;
   }
 
   // Increment (postfix)
   SyncVar operator++(int) {
-    Cli cli;
-    SyncVar temp(*this);
-    ++_value;
-    return temp;
+    return SyncVar(update([](T& value) { ++value; }));
   }
 
   // Decrement (postfix)
   SyncVar operator--(int) {
-    Cli cli;
-    SyncVar temp(*this);
-    --_value;
-    return temp;
+    return SyncVar(update([](T& value) { --value; }));
   }
 
   // Bitwise NOT
   SyncVar operator~() {
-    Cli cli;
-    SyncVar temp(~_value);
-    return temp;
+    return SyncVar(~load());
   }
 
   // Bitwise AND
   SyncVar operator&(const T& rhs) {
-    Cli cli;
-    SyncVar temp(_value & rhs);
-    return temp;
+    return SyncVar(load() & rhs);
   }
 
   // Bitwise OR
   SyncVar operator|(const T& rhs) {
-    Cli cli;
-    SyncVar temp(_value | rhs);
-    return temp;
+    return SyncVar(load() | rhs);
   }
 
   // Logical AND
   bool operator&&(const T& rhs) {
-    Cli cli;
-    bool result = _value && rhs;
-    return result;
+    return load() && rhs;
   }
 
   // Logical OR
   bool operator||(const T& rhs) {
-    Cli cli;
-    bool result = _value || rhs;
-    return result;
+    return load() || rhs;
   }
 
   // Bitwise AND assignment
   SyncVar& operator&=(const T& rhs) {
-    Cli cli;
-    _value &= rhs;
+    update([&](T& value) { value &= rhs; });
     return *this;
   }
 
   // Bitwise OR assignment
   SyncVar& operator|=(const T& rhs) {
-    Cli cli;
-    _value |= rhs;
+    update([&](T& value) { value |= rhs; });
     return *this;
   }
 
   // Left shift
   SyncVar operator<<(int shift) {
-    Cli cli;
-    SyncVar temp(_value << shift);
-    return temp;
+    return SyncVar(load() << shift);
   }
 
   // Right shift
   SyncVar operator>>(int shift) {
-    Cli cli;
-    SyncVar temp(_value >> shift);
-    return temp;
+    return SyncVar(load() >> shift);
   }
 
   // Left shift assignment
   SyncVar& operator<<=(int shift) {
-    Cli cli;
-    _value <<= shift;
+    update([&](T& value) { value <<= shift; });
     return *this;
   }
 
   // Right shift assignment
   SyncVar& operator>>=(int shift) {
-    Cli cli;
-    _value >>= shift;
+    update([&](T& value) { value >>= shift; });
     return *this;
   }
 
   // Modulus and modulus assignment
   T operator%(const T& rhs) const {
-    Cli cli;
-    T result = _value % rhs;
-    return result;
+    return load() % rhs;
   }
   SyncVar& operator%=(const T& rhs) {
-    Cli cli;
-    _value %= rhs;
+    update([&](T& value) { value %= rhs; });
     return *this;
   }
 
   // Bitwise XOR and XOR assignment
   T operator^(const T& rhs) const {
-    Cli cli;
-    T result = _value ^ rhs;
-    return result;
+    return load() ^ rhs;
   }
 
   SyncVar& operator^=(const T& rhs) {
-    Cli cli;
-    _value ^= rhs;
+    update([&](T& value) { value ^= rhs; });
     return *this;
   }
 
-  // // Array subscripting
-  // T& operator[](size_t index) {
-  //   // Assume _value is an array or supports array-like access
-  //   Cli cli;
-  //   T& result = _value[index];
-  //   BTaskSwitcher::restore(sreg);
-  //   return result;
-  // }
-
   SyncVar operator+(const T& rhs) const {
-    Cli cli;
-    SyncVar temp(_value + rhs);
-    return temp;
+    return SyncVar(load() + rhs);
   }
 
   SyncVar operator-(const T& rhs) const {
-    Cli cli;
-    SyncVar temp(_value - rhs);
-    return temp;
+    return SyncVar(load() - rhs);
   }
 
   SyncVar operator*(const T& rhs) const {
-    Cli cli;
-    SyncVar temp(_value * rhs);
-    return temp;
+    return SyncVar(load() * rhs);
   }
 
   SyncVar operator/(const T& rhs) const {
-    Cli cli;
-    SyncVar temp(_value / rhs);
-    return temp;
+    return SyncVar(load() / rhs);
   }
 };
 
+// SyncVar<> which is also safe to share with interrupt handlers in the
+// cooperative build
+template<typename T>
+using IsrSyncVar = SyncVar<T, Buratino::BIsrLock>;
+
 #endif
\ No newline at end of file
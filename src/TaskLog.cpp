@@ -0,0 +1,139 @@
+#include "TaskLog.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+// each record is a length byte followed by the text, the length is written
+// last so the logger task never sees a record that is still being copied.
+// Records may wrap around the end of the buffer.
+
+TaskLogBase::TaskLogBase(char* data, unsigned size)
+  : _data(data), _size(size), _head(0), _tail(0), _used(0), _dropped(0), _reported(0), _out(0) {}
+
+// called from the tick interrupt
+bool TaskLogBase::has_line(void* log) {
+  auto self = (TaskLogBase*)log;
+  return self->_used && self->_data[self->_tail];
+}
+
+void TaskLogBase::logger_task(TaskLogBase* log) {
+  while (1) {
+    BTaskSwitcher::wait_until(has_line, log, TaskTimeout::Forever);
+    log->drain();
+  }
+}
+
+int TaskLogBase::begin(Print& out, unsigned stackSize, uint8_t priority) {
+  _out = &out;
+  return runTask(logger_task, this, stackSize, priority);
+}
+
+void TaskLogBase::copy_in(unsigned pos, const char* text, unsigned length) {
+  auto first = _size - pos;
+  if (first > length) {
+    first = length;
+  }
+  memcpy(_data + pos, text, first);
+  memcpy(_data, text + first, length - first);
+}
+
+// formats on the caller's stack, lines longer than TASKFUN_LOG_LINE - 3 are cut
+void TaskLogBase::log(const char* format, ...) {
+  char line[TASKFUN_LOG_LINE];
+  va_list args;
+  va_start(args, format);
+  auto length = vsnprintf(line, sizeof(line) - 2, format, args);
+  va_end(args);
+  if (length < 0) {
+    return;
+  }
+  if ((unsigned)length > sizeof(line) - 3) {
+    length = sizeof(line) - 3;
+  }
+  line[length++] = '\r';
+  line[length++] = '\n';
+  write(line, length);
+}
+
+// copies the text as one record, can be called from interrupt handlers
+void TaskLogBase::write(const char* text, unsigned length) {
+  if (length > 255) {
+    length = 255;
+  }
+  if (!length) {
+    return;
+  }
+
+  unsigned pos;
+  {
+    Cli cli;
+    if (_used + length + 1 > _size) {
+      ++_dropped;
+      return;
+    }
+    pos = _head;
+    _data[pos] = 0;
+    _head = (pos + length + 1) % _size;
+    _used += length + 1;
+  }
+
+  copy_in((pos + 1) % _size, text, length);
+  _data[pos] = (char)length;
+}
+
+// writes out all complete records in as few writes as possible
+void TaskLogBase::drain() {
+  unsigned used;
+  {
+    Cli cli;
+    used = _used;
+  }
+
+  // complete records don't change until they are released below
+  unsigned end = _tail;
+  unsigned count = 0;
+  while (count < used && _data[end]) {
+    auto length = (uint8_t)_data[end] + 1;
+    count += length;
+    end = (end + length) % _size;
+  }
+
+  // driven by the byte count, a full ring ends where it started
+  unsigned length = 0;
+  auto pos = _tail;
+  for (unsigned written = 0; written < count; written += length + 1) {
+    length = (uint8_t)_data[pos];
+    auto start = (pos + 1) % _size;
+    auto first = _size - start;
+    if (first > length) {
+      first = length;
+    }
+    _out->write((const uint8_t*)_data + start, first);
+    _out->write((const uint8_t*)_data, length - first);
+    pos = (start + length) % _size;
+  }
+
+  {
+    Cli cli;
+    _tail = end;
+    _used -= count;
+  }
+
+  auto dropped = this->dropped();
+  if (dropped != _reported) {
+    _out->print(F("[log dropped "));
+    _out->print(dropped - _reported);
+    _out->println(F(" lines]"));
+    _reported = dropped;
+  }
+}
+
+unsigned long TaskLogBase::dropped() {
+  Cli cli;
+  return _dropped;
+}
+
+// free space in bytes, each line takes its length plus one
+unsigned TaskLogBase::available() {
+  Cli cli;
+  return _size - _used;
+}
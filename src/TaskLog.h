@@ -0,0 +1,59 @@
+#ifndef __TASKLOG_H__
+#define __TASKLOG_H__
+
+#include <Arduino.h>
+#include "BTaskSwitcher.h"
+
+// longest formatted log line including the terminating zero
+#ifndef TASKFUN_LOG_LINE
+#define TASKFUN_LOG_LINE 64
+#endif
+
+/*
+  TaskLog - log lines are copied into a ring buffer and written out to a Print
+  by a low priority logger task, so logging never waits for the output. Lines
+  that don't fit are dropped and counted.
+*/
+class TaskLogBase {
+protected:
+  typedef Buratino::BTaskSwitcher BTaskSwitcher;
+  typedef BTaskSwitcher::BDisableInterrupts Cli;
+
+protected:
+  char* _data;
+  unsigned _size;
+  unsigned _head;  // next record is reserved here
+  unsigned _tail;  // oldest record, drained by the logger task
+  volatile unsigned _used;
+  volatile unsigned long _dropped;
+  unsigned long _reported;
+  Print* _out;
+
+protected:
+  static bool has_line(void* log);
+  static void logger_task(TaskLogBase* log);
+  void copy_in(unsigned pos, const char* text, unsigned length);
+  void drain();
+
+  TaskLogBase(char* data, unsigned size);
+
+public:
+  int begin(Print& out, unsigned stackSize = 128 * sizeof(int), uint8_t priority = TaskPriority::Low);
+  void log(const char* format, ...);
+  void write(const char* text, unsigned length);
+  unsigned long dropped();
+  unsigned available();
+};
+
+// Size is the ring buffer size in bytes
+template<unsigned Size = 256>
+class TaskLog : public TaskLogBase {
+protected:
+  char _buffer[Size];
+
+public:
+  TaskLog()
+    : TaskLogBase(_buffer, Size) {}
+};
+
+#endif
@@ -0,0 +1,99 @@
+#include "TaskStream.h"
+
+// called from the tick interrupt
+bool TaskStream::readable(void* stream) {
+  return ((Stream*)stream)->available() > 0;
+}
+
+bool TaskStream::writable(void* stream) {
+  return ((Stream*)stream)->availableForWrite() > 0;
+}
+
+TaskStream::TaskStream(Stream& stream)
+  : _stream(stream), _writable(false) {}
+
+bool TaskStream::wait_readable() {
+  return BTaskSwitcher::wait_until(readable, &_stream, _timeout);
+}
+
+int TaskStream::available() {
+  return _stream.available();
+}
+
+// waits up to the timeout for a byte, returns -1 on timeout
+int TaskStream::read() {
+  return wait_readable() ? _stream.read() : -1;
+}
+
+int TaskStream::peek() {
+  return wait_readable() ? _stream.peek() : -1;
+}
+
+size_t TaskStream::write(uint8_t value) {
+  return write(&value, 1);
+}
+
+// writes as much as fits in the output buffer and waits for space for the
+// rest, streams that never reported availableForWrite() are written directly.
+// Returns a short count if the timeout expires.
+size_t TaskStream::write(const uint8_t* buffer, size_t size) {
+  size_t written = 0;
+  while (written < size) {
+    int space = _stream.availableForWrite();
+    if (space > 0) {
+      _writable = true;
+    } else if (!_writable) {
+      return written + _stream.write(buffer + written, size - written);
+    } else {
+      if (!BTaskSwitcher::wait_until(writable, &_stream, _timeout)) {
+        setWriteError();
+        return written;
+      }
+      space = _stream.availableForWrite();
+    }
+
+    size_t count = size - written;
+    if (count > (size_t)space) {
+      count = space;
+    }
+    auto n = _stream.write(buffer + written, count);
+    if (!n) {
+      break;
+    }
+    written += n;
+  }
+  return written;
+}
+
+int TaskStream::availableForWrite() {
+  return _stream.availableForWrite();
+}
+
+void TaskStream::flush() {
+  _stream.flush();
+}
+
+// the timeout applies to each byte like in Stream::readBytes()
+size_t TaskStream::readBytes(char* buffer, size_t length) {
+  size_t count = 0;
+  while (count < length) {
+    auto c = read();
+    if (c < 0) {
+      break;
+    }
+    buffer[count++] = (char)c;
+  }
+  return count;
+}
+
+size_t TaskStream::readBytesUntil(char terminator, char* buffer, size_t length) {
+  size_t count = 0;
+  while (count < length) {
+    auto c = read();
+    if (c < 0 || c == terminator) {
+      break;
+    }
+    buffer[count++] = (char)c;
+  }
+  return count;
+}
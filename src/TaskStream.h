@@ -0,0 +1,46 @@
+#ifndef __TASKSTREAM_H__
+#define __TASKSTREAM_H__
+
+#include <Arduino.h>
+#include "BTaskSwitcher.h"
+
+/*
+  TaskStream - wraps a Stream, reads and writes suspend the calling task
+  until data or buffer space is available instead of busy-waiting
+*/
+class TaskStream : public Stream {
+protected:
+  typedef Buratino::BTaskSwitcher BTaskSwitcher;
+
+protected:
+  Stream& _stream;
+  bool _writable;  // the stream reported space for writing at least once
+
+protected:
+  static bool readable(void* stream);
+  static bool writable(void* stream);
+  bool wait_readable();
+
+public:
+  TaskStream(Stream& stream);
+
+  virtual int available();
+  virtual int read();
+  virtual int peek();
+  virtual size_t write(uint8_t value);
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  virtual int availableForWrite();
+  virtual void flush();
+  using Print::write;
+
+  size_t readBytes(char* buffer, size_t length);
+  size_t readBytes(uint8_t* buffer, size_t length) {
+    return readBytes((char*)buffer, length);
+  }
+  size_t readBytesUntil(char terminator, char* buffer, size_t length);
+  size_t readBytesUntil(char terminator, uint8_t* buffer, size_t length) {
+    return readBytesUntil(terminator, (char*)buffer, length);
+  }
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef __TASKTABLE_H__
+#define __TASKTABLE_H__
+
+#include "BTaskSwitcher.h"
+
+/*
+  StaticTask - a task with its control block and stack in static storage,
+  started by the TaskTable it's listed in. The initial context is prepared
+  when the object is constructed.
+*/
+template<typename T, unsigned StackSize = 256 * sizeof(int)>
+class StaticTask {
+protected:
+  typedef Buratino::BTaskSwitcher BTaskSwitcher;
+  typedef BTaskSwitcher::BStaticTaskInfo<T> BInfo;
+
+protected:
+  BInfo _info;
+  uint8_t _stack[StackSize + __BTASKSWITCHER_CONTEXT_SIZE__];
+
+  template<uint8_t Count>
+  friend class TaskTable;
+
+public:
+  StaticTask(void (*task)(T arg), T arg, uint8_t priority = TaskPriority::Medium)
+    : _info(task, arg) {
+    // can't fail in a constructor, an invalid priority runs as low
+    _info.priority(priority > TaskPriority::Low ? TaskPriority::Low : priority);
+    _info.sp = &_stack[sizeof(_stack) - 1];
+    _info.destroy = BTaskSwitcher::destroy_static<BInfo>;
+    BTaskSwitcher::init_task(&_info, (BTaskSwitcher::BTaskWrapper)BTaskSwitcher::static_wrapper<T>);
+  }
+};
+
+/*
+  TaskTable - the task list, loop() and the idle task in static storage, pass
+  it to setupTasks() to start the listed tasks without using the heap
+*/
+template<uint8_t Count>
+class TaskTable {
+protected:
+  typedef Buratino::BTaskSwitcher BTaskSwitcher;
+  static const unsigned Capacity = Count + 2;  // loop() and idle
+
+  static_assert(Capacity <= BTaskSwitcher::MaxTasks, "too many tasks");
+
+protected:
+  BTaskSwitcher::BTaskInfoBase* _tasks[Capacity];
+  int _free[Capacity];
+  BTaskSwitcher::BSlot _reap[Capacity];
+  BTaskSwitcher::BTaskInfoBase _loop;
+  StaticTask<int, TASKFUN_IDLE_STACK> _idle;
+  BTaskSwitcher::BTaskInfoBase* _initial[Count ? Count : 1];
+
+  template<uint8_t N>
+  friend void setupTasks(TaskTable<N>& table, int msSlice, uint8_t loopPriority);
+
+  void start(int slice, uint8_t loop_pri) {
+    BTaskSwitcher::BStaticTable table = { _tasks, _free, _reap, Capacity, &_loop, &_idle._info, _initial, Count };
+    BTaskSwitcher::initialize(table, slice, loop_pri);
+  }
+
+public:
+  template<typename... Tasks>
+  TaskTable(Tasks&... tasks)
+    : _idle(BTaskSwitcher::idle_task, 0, TaskPriority::Low), _initial{ &tasks._info... } {
+    static_assert(sizeof...(Tasks) == Count, "list all Count tasks");
+  }
+};
+
+template<uint8_t Count>
+void setupTasks(TaskTable<Count>& table, int msSlice = 1, uint8_t loopPriority = 1) {
+  table.start(msSlice, loopPriority);
+}
+
+#endif
@@ -3,5 +3,14 @@
 
 #include "BTaskSwitcher.h"
 #include "SyncVar.h"
+#include "BTimerService.h"
+#include "TaskStream.h"
+#include "BufferPool.h"
+#include "Channel.h"
+#include "Topic.h"
+#include "ConditionVariable.h"
+#include "BTaskHeap.h"
+#include "TaskLog.h"
+#include "TaskTable.h"
 
 #endif
\ No newline at end of file
@@ -0,0 +1,92 @@
+#ifndef __TOPIC_H__
+#define __TOPIC_H__
+
+#include "BTaskSwitcher.h"
+
+/*
+  Topic - broadcasts items to any number of subscribers through one ring of
+  Count slots. publish() never waits, a subscriber that falls more than Count
+  items behind skips the oldest ones and counts them as overruns.
+*/
+template<typename T, uint8_t Count>
+class Topic {
+protected:
+  typedef Buratino::BTaskSwitcher BTaskSwitcher;
+  typedef BTaskSwitcher::BDisableInterrupts Cli;
+
+protected:
+  T _items[Count];
+  uint8_t _head;  // slot of the next item
+  volatile unsigned long _published;  // number of items ever published
+
+protected:
+  // call with interrupts disabled, waits until something is published
+  bool wait(unsigned long timeoutMs) {
+    return BTaskSwitcher::wait_until(0, this, timeoutMs);
+  }
+
+public:
+  /*
+    Subscriber - reads the items published after it was created, each
+    subscriber has its own position in the topic
+  */
+  class Subscriber {
+  protected:
+    Topic& _topic;
+    unsigned long _next;  // number of the next item to receive
+    unsigned long _overruns;
+
+  public:
+    Subscriber(Topic& topic)
+      : _topic(topic), _next(topic._published), _overruns(0) {}
+
+    // returns false if nothing was published within the timeout
+    bool receive(T& item, unsigned long timeoutMs = TaskTimeout::Forever) {
+      Cli cli;
+      if (_next == _topic._published && !_topic.wait(timeoutMs)) {
+        return false;
+      }
+
+      auto behind = _topic._published - _next;
+      if (behind > Count) {
+        _overruns += behind - Count;
+        behind = Count;
+      }
+      auto slot = _topic._head + Count - behind;
+      item = _topic._items[slot >= Count ? slot - Count : slot];
+      _next = _topic._published - behind + 1;
+      return true;
+    }
+
+    // number of items waiting to be received, at most Count
+    uint8_t available() {
+      Cli cli;
+      auto behind = _topic._published - _next;
+      return behind > Count ? Count : behind;
+    }
+
+    // number of items that were overwritten before this subscriber got them
+    unsigned long overruns() {
+      Cli cli;
+      return _overruns;
+    }
+  };
+
+public:
+  Topic()
+    : _head(0), _published(0) {}
+
+  // one copy into the ring however many subscribers there are, can be called
+  // from interrupt handlers
+  void publish(const T& item) {
+    Cli cli;
+    _items[_head] = item;
+    if (++_head == Count) {
+      _head = 0;
+    }
+    ++_published;
+    BTaskSwitcher::signal(this, true);
+  }
+};
+
+#endif